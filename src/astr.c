@@ -68,6 +68,14 @@ castr_new_nstr (const char *s, size_t n)
   return as;
 }
 
+castr
+castr_set_nstr (castr as, const char *s, size_t n)
+{
+  ((astr) as)->len = n;
+  ((astr) as)->text = (char *) s;
+  return as;
+}
+
 const char *
 astr_cstr (castr as)
 {
@@ -80,18 +88,56 @@ astr_len (castr as)
   return as->len;
 }
 
-static
-void astr_set_len (astr as, size_t len)
+#ifdef TEST
+static size_t astr_realloc_count = 0;
+#endif
+
+static void
+astr_set_maxlen (astr as, size_t maxlen)
 {
-  if (len > as->maxlen || len < as->maxlen / 2)
-    {
-      as->maxlen = len + ALLOCATION_CHUNK_SIZE;
-      as->text = xrealloc (as->text, as->maxlen + 1);
-    }
+  as->maxlen = maxlen;
+  as->text = xrealloc (as->text, as->maxlen + 1);
+#ifdef TEST
+  astr_realloc_count++;
+#endif
+}
+
+/*
+ * Grow the buffer geometrically, so that a sequence of appends costs
+ * amortized constant time per character.  Only shrink it once the
+ * string has dropped to a quarter of the buffer, so that a string
+ * whose length oscillates does not realloc on every change.
+ */
+static void
+astr_set_len (astr as, size_t len)
+{
+  if (len > as->maxlen)
+    astr_set_maxlen (as, MAX (len + ALLOCATION_CHUNK_SIZE, as->maxlen * 2));
+  else if (len < as->len && len < as->maxlen / 4
+           && as->maxlen > ALLOCATION_CHUNK_SIZE)
+    astr_set_maxlen (as, MAX (len * 2, ALLOCATION_CHUNK_SIZE));
   as->len = len;
   as->text[as->len] = '\0';
 }
 
+astr
+astr_reserve (astr as, size_t size)
+{
+  assert (as != NULL);
+  if (size > as->maxlen)
+    astr_set_maxlen (as, as->len > 0 ? MAX (size, as->maxlen * 2) : size);
+  return as;
+}
+
+astr
+astr_shrink_to_fit (astr as)
+{
+  assert (as != NULL);
+  if (as->maxlen > as->len)
+    astr_set_maxlen (as, as->len);
+  return as;
+}
+
 astr
 astr_cat_nstr (astr as, const char *s, size_t csize)
 {
@@ -171,7 +217,9 @@ astr_get (castr as, size_t pos)
 static astr
 astr_ncpy_cstr (astr as, const char *s, size_t len)
 {
-  astr_truncate (as, 0);
+  /* Don't let the truncation shrink a buffer we are about to refill. */
+  astr_reserve (as, len);
+  as->len = 0;
   return astr_cat_nstr (as, s, len);
 }
 
@@ -229,20 +277,53 @@ astr
 astr_readf (const char *filename)
 {
   astr as = NULL;
-  struct stat st;
-  if (stat (filename, &st) == 0)
+  int fd = open (filename, O_RDONLY);
+  if (fd >= 0)
+    {
+      struct stat st;
+      if (fstat (fd, &st) == 0)
+        {
+          /* Read straight into a buffer presized from the file size,
+             leaving room to notice EOF without growing it.  If the
+             file grew meanwhile, the buffer grows as usual. */
+          as = astr_reserve (astr_new (), (size_t) st.st_size + 1);
+          for (;;)
+            {
+              if (as->len == as->maxlen)
+                astr_reserve (as, as->maxlen * 2);
+              ssize_t n = read (fd, as->text + as->len, as->maxlen - as->len);
+              if (n <= 0)
+                {
+                  if (n < 0)
+                    as = NULL;
+                  break;
+                }
+              as->len += n;
+            }
+          if (as)
+            as->text[as->len] = '\0';
+        }
+      close (fd);
+    }
+  return as;
+}
+
+astr
+astr_cat_fd (astr as, int fd, off_t pos, size_t len)
+{
+  astr_reserve (as, as->len + len);
+  for (size_t done = 0; done < len;)
     {
-      size_t size = st.st_size;
-      int fd = open (filename, O_RDONLY);
-      if (fd >= 0)
+      ssize_t n = pread (fd, as->text + as->len + done, len - done, pos + done);
+      if (n <= 0)
         {
-          char buf[BUFSIZ];
-          as = astr_new ();
-          while ((size = read (fd, buf, BUFSIZ)) > 0)
-            astr_cat_nstr (as, buf, size);
-          close (fd);
+          as->text[as->len] = '\0';
+          return NULL;
         }
+      done += n;
     }
+  as->len += len;
+  as->text[as->len] = '\0';
   return as;
 }
 
@@ -284,6 +365,7 @@ astr_recase (astr as, enum casing newcase)
 #include <config.h>
 
 #include <stdio.h>
+#include <time.h>
 #include "progname.h"
 
 #include "main.h"
@@ -298,6 +380,40 @@ assert_eq (astr as, const char *s)
     }
 }
 
+/*
+ * Append `n' characters one at a time, and check that with geometric
+ * growth the number of reallocations grows only logarithmically.
+ * Returns the time taken in seconds.
+ */
+static double
+test_append (size_t n)
+{
+  astr as = astr_new ();
+  size_t reallocs = astr_realloc_count;
+  clock_t start = clock ();
+  for (size_t i = 0; i < n; i++)
+    astr_cat_char (as, 'x');
+  double secs = (double) (clock () - start) / CLOCKS_PER_SEC;
+  reallocs = astr_realloc_count - reallocs;
+  if (astr_len (as) != n || reallocs > 64)
+    {
+      printf ("test failed: %zu reallocs for %zu appends\n", reallocs, n);
+      exit (EXIT_FAILURE);
+    }
+  return secs;
+}
+
+/*
+ * Micro-benchmark, run by `make bench': the time per character
+ * appended should stay flat as `n' grows.
+ */
+static void
+bench_append (void)
+{
+  for (size_t n = 1 << 14; n <= 1 << 22; n <<= 2)
+    printf ("append %7zu chars: %6.2f ns/char\n", n, test_append (n) * 1e9 / n);
+}
+
 int
 main (int argc _GL_UNUSED_PARAMETER, char **argv)
 {
@@ -346,6 +462,59 @@ main (int argc _GL_UNUSED_PARAMETER, char **argv)
   astr_recase (as1, case_lower);
   assert_eq (as1, "some text");
 
+  astr_reserve (as1, 1000);
+  astr_cat_cstr (as1, "!");
+  assert_eq (as1, "some text!");
+  astr_shrink_to_fit (as1);
+  assert_eq (as1, "some text!");
+  astr_truncate (as1, 4);
+  assert_eq (as1, "some");
+
+  {
+    /* Reading a file presizes the buffer: exactly one allocation. */
+    char name[] = "/tmp/astrXXXXXX";
+    int fd = mkstemp (name);
+    as2 = astr_new ();
+    for (size_t i = 0; i < 100000; i++)
+      astr_cat_char (as2, 'a' + i % 26);
+    if (fd < 0 || write (fd, astr_cstr (as2), astr_len (as2)) != (ssize_t) astr_len (as2))
+      {
+        printf ("test failed: could not write %s\n", name);
+        exit (EXIT_FAILURE);
+      }
+    close (fd);
+    size_t reallocs = astr_realloc_count;
+    as1 = astr_readf (name);
+    if (as1 == NULL || !STREQ (astr_cstr (as1), astr_cstr (as2))
+        || astr_realloc_count - reallocs != 1)
+      {
+        printf ("test failed: astr_readf\n");
+        exit (EXIT_FAILURE);
+      }
+
+    /* Reading part of a file, and reading past its end. */
+    fd = open (name, O_RDONLY);
+    unlink (name);
+    as1 = astr_cat_fd (astr_new_cstr ("x"), fd, 26, 3);
+    if (as1 == NULL)
+      {
+        printf ("test failed: astr_cat_fd\n");
+        exit (EXIT_FAILURE);
+      }
+    assert_eq (as1, "xabc");
+    if (astr_cat_fd (as1, fd, astr_len (as2) - 1, 2) != NULL)
+      {
+        printf ("test failed: astr_cat_fd past EOF\n");
+        exit (EXIT_FAILURE);
+      }
+    assert_eq (as1, "xabc");
+    close (fd);
+  }
+
+  test_append (1 << 14);
+  if (getenv ("ASTR_BENCH"))
+    bench_append ();
+
   printf ("astr test successful.\n");
 
   return EXIT_SUCCESS;
@@ -25,6 +25,7 @@
 #include <stddef.h>
 #include <stdio.h>
 #include <stdarg.h>
+#include <sys/types.h>
 
 /*
  * The astr library provides dynamically allocated null-terminated C
@@ -59,6 +60,12 @@ astr astr_new_cstr (const char *s);
  */
 castr castr_new_nstr (const char *s, size_t n);
 
+/*
+ * Point a constant string made by castr_new_nstr at a different
+ * counted C string, without allocating.
+ */
+castr castr_set_nstr (castr as, const char *s, size_t n);
+
 /*
  * Convert as into a C null-terminated string.
  * as[0] to as[astr_len (as) - 1] inclusive may be read.
@@ -126,12 +133,31 @@ astr astr_set (astr as, size_t pos, int c, size_t n);
  */
 astr astr_truncate (astr as, size_t pos);
 
+/*
+ * Make sure `as' can hold at least `size' characters without being
+ * reallocated.  A string that already holds text grows at least
+ * geometrically, so reserving before each of a run of appends stays
+ * cheap.
+ */
+astr astr_reserve (astr as, size_t size);
+
+/*
+ * Release any storage held by `as' beyond its current length.
+ */
+astr astr_shrink_to_fit (astr as);
+
 /*
  * Read file contents into an astr.
  * Returns NULL if the file doesn't exist, or other error.
  */
 astr astr_readf (const char *filename);
 
+/*
+ * Append `len' bytes read from `fd' at offset `pos' to `as'.
+ * Returns NULL on error or early EOF.
+ */
+astr astr_cat_fd (astr as, int fd, off_t pos, size_t len);
+
 /*
  * Format text into a string and return it.
  */
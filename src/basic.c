@@ -144,7 +144,7 @@ Goto the given line number, counting from line 1 at beginning of buffer.")
   if (n >= LONG_MAX - 1)
     return SCM_BOOL_F;
 
-  move_line ((MAX (n, 1) - 1) - offset_to_line (cur_bp, get_buffer_pt (cur_bp)));
+  goto_offset (line_to_offset (cur_bp, MAX (n, 1) - 1));
   G_beginning_of_line ();
   return SCM_BOOL_T;
 }
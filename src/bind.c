@@ -253,11 +253,15 @@ set_this_command (SCM cmd)
   _this_command = cmd;
 }
 
+/* Depth of nested calls to call_command. */
+static int command_depth = 0;
+
 SCM
 call_command (SCM proc, int uniarg, bool uniflag)
 {
   SCM ok;
   thisflag = lastflag & FLAG_DEFINING_MACRO;
+  command_depth++;
 
   /* Reset last_uniarg before function call, so recursion (e.g. in
      macros) works. */
@@ -294,6 +298,15 @@ call_command (SCM proc, int uniarg, bool uniflag)
 
   lastflag = thisflag;
 
+  /* Release the temporary markers of the outermost command, and trim
+     the undo history of every buffer it may have edited. */
+  if (--command_depth == 0)
+    {
+      release_weak_markers ();
+      for (Buffer *bp = head_bp; bp != NULL; bp = get_buffer_next (bp))
+        undo_trim (bp);
+    }
+
   return ok;
 }
 
@@ -446,6 +459,7 @@ init_default_bindings (void)
   set_key ("\\C-j", "newline-and-indent");
   set_key ("\\DOWN", "next-line");
   set_key ("\\C-n", "next-line");
+  set_key ("\\M-so", "occur");
   set_key ("\\C-o", "open-line");
   set_key ("\\C-xo", "other-window");
   set_key ("\\UP", "previous-line");
@@ -35,6 +35,8 @@
 #include "main.h"
 #include "extern.h"
 #include "memrmem.h"
+#include "piece.h"
+#include "lineindex.h"
 
 
 /*
@@ -49,7 +51,12 @@ struct Buffer
 #undef FIELD_STR
   size_t pt;         /* The point. */
   estr text;         /* The text. */
-  size_t gap;        /* Size of gap after point. */
+  size_t gap;        /* Size of the gap. */
+  size_t gapo;       /* Offset of the gap; it only moves on edits. */
+  Piece_table *pieces; /* The text, when held in a piece table. */
+  Line_index *line_index; /* Line lengths, built on first use. */
+  castr pre_gap_view;  /* Reused by get_buffer_pre_gap. */
+  castr post_gap_view; /* Reused by get_buffer_post_gap. */
 };
 
 #define FIELD(ty, field)                         \
@@ -64,25 +71,114 @@ struct Buffer
 #undef FIELD
 #undef FIELD_STR
 
-/* Buffer methods that know about the gap. */
+/* Buffer methods that know about the gap.
+
+   A buffer's text is held either in a gap buffer, `text' and `gap',
+   or, when `pieces' is non-NULL, in a piece table; in the latter case
+   `text' holds only the EOL type. */
+
+/*
+ * Return the text before the gap of a gap buffer.  Together with the
+ * text after the gap, this makes up the whole of the buffer's text.
+ * The result is a view into the buffer, valid until the buffer is
+ * next changed or this function is next called.
+ */
+static castr
+get_buffer_pre_gap (Buffer *bp)
+{
+  if (bp->pre_gap_view == NULL)
+    bp->pre_gap_view = castr_new_nstr (NULL, 0);
+  return castr_set_nstr (bp->pre_gap_view, astr_cstr (bp->text.as), bp->gapo);
+}
+
+/*
+ * Return the text after the gap, as a view like get_buffer_pre_gap.
+ */
+static castr
+get_buffer_post_gap (Buffer *bp)
+{
+  if (bp->post_gap_view == NULL)
+    bp->post_gap_view = castr_new_nstr (NULL, 0);
+  return castr_set_nstr (bp->post_gap_view, astr_cstr (bp->text.as) + bp->gapo + bp->gap,
+                         astr_len (bp->text.as) - (bp->gapo + bp->gap));
+}
+
+/* Source of the buffers' change ticks. */
+static size_t ticks = 0;
+
+/*
+ * Record that `del' chars at `o' in `bp' were replaced by `ins'
+ * chars, or with `del' SIZE_MAX that all its text was, bumping its
+ * change tick and growing the range redisplay must redraw.
+ */
+static void
+buffer_changed (Buffer *bp, size_t o, size_t del, size_t ins)
+{
+  bp->tick = ++ticks;
+  if (del == SIZE_MAX)
+    {
+      bp->dirty_start = 0;
+      bp->dirty_end = SIZE_MAX;
+    }
+  else if (bp->dirty_start == SIZE_MAX)
+    {
+      bp->dirty_start = o;
+      bp->dirty_end = o + ins;
+      bp->dirty_old_end = o + del;
+    }
+  else if (bp->dirty_end != SIZE_MAX)
+    {
+      bp->dirty_start = MIN (bp->dirty_start, o);
+      if (o + del > bp->dirty_end)
+        {
+          bp->dirty_old_end += o + del - bp->dirty_end;
+          bp->dirty_end = o + ins;
+        }
+      else
+        bp->dirty_end += ins - del;
+    }
+}
 
 void
 set_buffer_text (Buffer *bp, estr es)
 {
+  buffer_changed (bp, 0, SIZE_MAX, 0);
   bp->text = es;
+  bp->line_index = NULL;
+  if (bp->pieces)
+    {
+      bp->pieces = piece_table_new (es.as);
+      bp->text.as = astr_new ();
+    }
 }
 
-castr
-get_buffer_pre_point (Buffer *bp)
+bool
+get_buffer_piece_table (Buffer *bp)
 {
-  return castr_new_nstr (astr_cstr (bp->text.as), get_buffer_pt (bp));
+  return bp->pieces != NULL;
 }
 
-castr
-get_buffer_post_point (Buffer *bp)
+/*
+ * Switch the buffer between the gap buffer and piece table
+ * representations.
+ */
+void
+set_buffer_piece_table (Buffer *bp, bool on)
 {
-  return castr_new_nstr (astr_cstr (bp->text.as) + bp->pt + bp->gap,
-                         astr_len (bp->text.as) - (bp->pt + bp->gap));
+  if (on && !bp->pieces)
+    {
+      astr as = astr_cat (astr_cpy (astr_new (), get_buffer_pre_gap (bp)),
+                          get_buffer_post_gap (bp));
+      bp->pieces = piece_table_new (as);
+      bp->text.as = astr_new ();
+      bp->gap = bp->gapo = 0;
+    }
+  else if (!on && bp->pieces)
+    {
+      bp->text.as = piece_table_cat (astr_new (), bp->pieces, 0,
+                                     piece_table_len (bp->pieces));
+      bp->pieces = NULL;
+    }
 }
 
 size_t
@@ -94,17 +190,70 @@ get_buffer_pt (Buffer *bp)
 static void
 set_buffer_pt (Buffer *bp, size_t o)
 {
-  if (o < bp->pt)
+  bp->pt = o;
+}
+
+/*
+ * Move the gap to offset `o'.
+ */
+static void
+move_gap (Buffer *bp, size_t o)
+{
+  if (bp->gap == 0)
+    ;
+  else if (o < bp->gapo)
     {
-      astr_move (bp->text.as, o + bp->gap, o, bp->pt - o);
-      astr_set (bp->text.as, o, '\0', MIN (bp->pt - o, bp->gap));
+      astr_move (bp->text.as, o + bp->gap, o, bp->gapo - o);
+      astr_set (bp->text.as, o, '\0', MIN (bp->gapo - o, bp->gap));
     }
-  else if (o > bp->pt)
+  else if (o > bp->gapo)
     {
-      astr_move (bp->text.as, bp->pt, bp->pt + bp->gap, o - bp->pt);
-      astr_set (bp->text.as, o + bp->gap - MIN (o - bp->pt, bp->gap), '\0', MIN (o - bp->pt, bp->gap));
+      astr_move (bp->text.as, bp->gapo, bp->gapo + bp->gap, o - bp->gapo);
+      astr_set (bp->text.as, o + bp->gap - MIN (o - bp->gapo, bp->gap), '\0', MIN (o - bp->gapo, bp->gap));
     }
-  bp->pt = o;
+  bp->gapo = o;
+}
+
+/*
+ * Return true if offset `o' falls between the two characters of an
+ * EOL; the gap must not go there, or line scans would miss the EOL.
+ */
+static bool
+splits_eol (Buffer *bp, size_t o)
+{
+  const char *eol = get_buffer_eol (bp);
+  return eol[1] != '\0' && o > 0 && o < get_buffer_size (bp)
+    && get_buffer_char (bp, o - 1) == eol[0] && get_buffer_char (bp, o) == eol[1];
+}
+
+/*
+ * Return a contiguous stretch of the buffer's text holding at least
+ * [from, to), as a view like get_buffer_pre_gap's, and set `*base'
+ * to the offset of its first character.  The gap is only moved if it
+ * lies inside the range, and then to whichever end of it is nearer.
+ * A piece table has no such stretch, so just the range is copied;
+ * to read one in place, use buffer_span.
+ */
+castr
+get_buffer_text_view (Buffer *bp, size_t from, size_t to, size_t *base)
+{
+  *base = from;
+  if (bp->pieces)
+    return piece_table_cat (astr_new (), bp->pieces, from, to - from);
+
+  *base = 0;
+  if (from < bp->gapo && bp->gapo < to)
+    {
+      size_t o = bp->gapo - from < to - bp->gapo ? from : to;
+      if (splits_eol (bp, o))
+        o = o == from ? o - 1 : o + 1;
+      move_gap (bp, o);
+    }
+  castr pre = get_buffer_pre_gap (bp);
+  if (to <= bp->gapo)
+    return pre;
+  *base = bp->gapo;
+  return get_buffer_post_gap (bp);
 }
 
 static inline size_t
@@ -112,8 +261,8 @@ realo_to_o (Buffer *bp, size_t o)
 {
   if (o == SIZE_MAX)
     return o;
-  else if (o < bp->pt + bp->gap)
-    return MIN (o, bp->pt);
+  else if (o < bp->gapo + bp->gap)
+    return MIN (o, bp->gapo);
   else
     return o - bp->gap;
 }
@@ -121,29 +270,94 @@ realo_to_o (Buffer *bp, size_t o)
 static inline size_t
 o_to_realo (Buffer *bp, size_t o)
 {
-  return o < bp->pt ? o : o + bp->gap;
+  return o < bp->gapo ? o : o + bp->gap;
 }
 
 size_t
 get_buffer_size (Buffer * bp)
 {
+  if (bp->pieces)
+    return piece_table_len (bp->pieces);
   return realo_to_o (bp, astr_len (bp->text.as));
 }
 
+static size_t
+pieces_start_of_line (Buffer *bp, size_t o)
+{
+  size_t eol_len = strlen (get_buffer_eol (bp));
+  size_t prev = piece_table_rfind (bp->pieces, o, get_buffer_eol (bp), eol_len);
+  return prev == SIZE_MAX ? 0 : prev + eol_len;
+}
+
+static size_t
+pieces_end_of_line (Buffer *bp, size_t o)
+{
+  size_t next = piece_table_find (bp->pieces, o, get_buffer_eol (bp),
+                                  strlen (get_buffer_eol (bp)));
+  return next == SIZE_MAX ? piece_table_len (bp->pieces) : next;
+}
+
 size_t
 buffer_line_len (Buffer *bp, size_t o)
 {
+  if (bp->pieces)
+    return pieces_end_of_line (bp, o) - pieces_start_of_line (bp, o);
   return realo_to_o (bp, estr_end_of_line (bp->text, o_to_realo (bp, o))) -
     realo_to_o (bp, estr_start_of_line (bp->text, o_to_realo (bp, o)));
 }
 
+/*
+ * Scan the lines from `o' to `end', which must be either the end of a
+ * line or, if `last' is true, the end of the buffer, and return their
+ * lengths in `*lens'.  A final part-line that has no EOL before `end'
+ * is not counted; its length is returned in `*rest'.
+ */
+static size_t
+scan_lines (Buffer *bp, size_t o, size_t end, bool last, size_t **lens, size_t *rest)
+{
+  static size_t *v = NULL, maxv = 0;
+  size_t n = 0, eol_len = strlen (get_buffer_eol (bp)), size = get_buffer_size (bp);
+  for (;;)
+    {
+      size_t eo = buffer_end_of_line (bp, o);
+      bool complete = eo < size && eo + eol_len <= end;
+      if (!complete && !last)
+        break;
+      if (n == maxv)
+        {
+          maxv = MAX (maxv * 2, 64);
+          v = (size_t *) xrealloc (v, maxv * sizeof (size_t));
+        }
+      v[n] = complete ? eo + eol_len - o : size - o;
+      o += v[n++];
+      if (!complete || (o == end && !last))
+        break;
+    }
+  *lens = v;
+  *rest = end - o;
+  return n;
+}
+
+static Line_index *
+get_buffer_line_index (Buffer *bp)
+{
+  if (bp->line_index == NULL)
+    {
+      size_t *lens, rest;
+      size_t n = scan_lines (bp, 0, get_buffer_size (bp), true, &lens, &rest);
+      bp->line_index = line_index_new ();
+      line_index_replace (bp->line_index, 0, 0, lens, n);
+    }
+  return bp->line_index;
+}
+
 /*
  * Replace `oldlen' chars after point with `newlen' chars from `newtext'.
  */
 #define MIN_GAP 1024 /* Minimum gap size after resize. */
 #define MAX_GAP 4096 /* Maximum permitted gap size. */
-bool
-replace_estr (size_t del, estr es)
+static bool
+replace_text (size_t del, estr es, bool adjust)
 {
   if (warn_if_readonly_buffer ())
     return false;
@@ -151,80 +365,206 @@ replace_estr (size_t del, estr es)
   size_t newlen = estr_len (es, get_buffer_eol (cur_bp));
   undo_save_block (cur_bp->pt, del, newlen);
 
-  /* Adjust gap. */
-  size_t oldgap = cur_bp->gap;
-  size_t added_gap = oldgap + del < newlen ? MIN_GAP : 0;
-  if (added_gap > 0)
-    { /* If gap would vanish, open it to MIN_GAP. */
-      astr_insert (cur_bp->text.as, cur_bp->pt, (newlen + MIN_GAP) - (oldgap + del));
-      cur_bp->gap = MIN_GAP;
+  /* Find the lines the edit touches, from `l1' at `ls' to `l2' ending at `le'. */
+  Line_index *li = cur_bp->line_index;
+  size_t l1 = 0, l2 = 0, ls = 0, le = 0;
+  bool last = false;
+  if (li)
+    {
+      size_t s2;
+      l1 = line_index_line (li, cur_bp->pt, &ls);
+      l2 = line_index_line (li, cur_bp->pt + del, &s2);
+      last = l2 + 1 == line_index_lines (li);
+      le = last ? get_buffer_size (cur_bp) : line_index_offset (li, l2 + 1);
     }
-  else if (oldgap + del > MAX_GAP + newlen)
-    { /* If gap would be larger than MAX_GAP, restrict it to MAX_GAP. */
-      astr_remove (cur_bp->text.as, cur_bp->pt + newlen + MAX_GAP, (oldgap + del) - (MAX_GAP + newlen));
-      cur_bp->gap = MAX_GAP;
+
+  if (cur_bp->pieces)
+    {
+      /* Convert to the buffer's EOL type if needed. */
+      if (!STREQ (es.eol, get_buffer_eol (cur_bp)))
+        es = estr_cat ((estr) {.as = astr_new (), .eol = get_buffer_eol (cur_bp)}, es);
+      piece_table_replace (cur_bp->pieces, cur_bp->pt, del, astr_cstr (es.as), newlen);
     }
   else
-    cur_bp->gap = oldgap + del - newlen;
+    {
+      move_gap (cur_bp, cur_bp->pt);
+
+      /* Adjust gap. */
+      size_t oldgap = cur_bp->gap;
+      size_t added_gap = oldgap + del < newlen ? (newlen + MIN_GAP) - (oldgap + del) : 0;
+      if (added_gap > 0)
+        { /* If gap would vanish, open it to MIN_GAP. */
+          astr_insert (cur_bp->text.as, cur_bp->pt, added_gap);
+          cur_bp->gap = MIN_GAP;
+        }
+      else if (oldgap + del > MAX_GAP + newlen)
+        { /* If gap would be larger than MAX_GAP, restrict it to MAX_GAP. */
+          astr_remove (cur_bp->text.as, cur_bp->pt + newlen + MAX_GAP, (oldgap + del) - (MAX_GAP + newlen));
+          cur_bp->gap = MAX_GAP;
+        }
+      else
+        cur_bp->gap = oldgap + del - newlen;
+
+      /* Zero the deleted text left in the gap. */
+      size_t stale = MAX (added_gap + oldgap, newlen);
+      if (stale < cur_bp->gap + newlen)
+        astr_set (cur_bp->text.as, cur_bp->pt + stale, '\0', newlen + cur_bp->gap - stale);
 
-  /* Zero any new bit of gap not produced by astr_insert. */
-  if (MAX (oldgap, newlen) + added_gap < cur_bp->gap + newlen)
-    astr_set (cur_bp->text.as, cur_bp->pt + MAX (oldgap, newlen) + added_gap, '\0', newlen + cur_bp->gap - MAX (oldgap, newlen) - added_gap);
+      /* Insert `newlen' chars. */
+      estr_replace_estr (cur_bp->text, cur_bp->pt, es);
+      cur_bp->gapo += newlen;
 
-  /* Insert `newlen' chars. */
-  estr_replace_estr (cur_bp->text, cur_bp->pt, es);
+      if (splits_eol (cur_bp, cur_bp->gapo))
+        move_gap (cur_bp, cur_bp->gapo + 1);
+    }
   cur_bp->pt += newlen;
 
-  /* Adjust markers. */
-  for (Marker *m = get_buffer_markers (cur_bp); m != NULL; m = get_marker_next (m))
-    if (get_marker_o (m) > cur_bp->pt - newlen)
-      set_marker_o (m, MAX (cur_bp->pt - newlen, get_marker_o (m) + newlen - del));
+  /* Rescan the lines the edit touched. */
+  if (li)
+    {
+      size_t *lens, rest;
+      size_t n = scan_lines (cur_bp, ls, le + newlen - del, last, &lens, &rest);
+      line_index_replace (li, l1, l2 - l1 + 1, lens, n);
+      if (rest > 0)
+        line_index_extend (li, l1 + n, rest);
+    }
 
+  if (adjust)
+    adjust_markers (cur_bp, cur_bp->pt - newlen, del, newlen);
+
+  buffer_changed (cur_bp, cur_bp->pt - newlen, del, newlen);
   set_buffer_modified (cur_bp, true);
-  if (estr_next_line (es, 0) != SIZE_MAX)
+  if (es.lines > 0 ? es.lines > 1 : estr_next_line (es, 0) != SIZE_MAX)
     thisflag |= FLAG_NEED_RESYNC;
   return true;
 }
 
+bool
+replace_estr (size_t del, estr es)
+{
+  return replace_text (del, es, true);
+}
+
+/*
+ * Replace the `n' regions `r', which must be in order and must not
+ * overlap, as a single change.  `es' is the new text from the start
+ * of the first region to the end of the last, in which the
+ * replacement for `r[i]' is `lens[i]' chars long; markers move as if
+ * each region had been replaced in turn.  Point is left after the
+ * last replacement.
+ */
+bool
+replace_regions (const Region *r, const size_t *lens, size_t n, estr es)
+{
+  if (n == 0)
+    return true;
+  if (warn_if_readonly_buffer ())
+    return false;
+
+  set_buffer_pt (cur_bp, r[0].start);
+  replace_text (r[n - 1].end - r[0].start, es, false);
+
+  /* `o' is where `r[i]' starts once the earlier regions are replaced. */
+  size_t o = r[0].start;
+  for (size_t i = 0; i < n; i++)
+    {
+      o += r[i].start - (i > 0 ? r[i - 1].end : r[0].start);
+      adjust_markers (cur_bp, o, get_region_size (r[i]), lens[i]);
+      o += lens[i];
+    }
+  return true;
+}
+
 bool
 insert_estr (estr es)
 {
   return replace_estr (0, es);
 }
 
+/*
+ * Replace each char `c' at index `i' of region `r' with `func (c,
+ * i)', in place and as a single undoable change.  `func' must map
+ * EOL characters to themselves.
+ */
+bool
+transform_region (Region r, int (*func) (int c, size_t i))
+{
+  if (warn_if_readonly_buffer ())
+    return false;
+
+  size_t size = get_region_size (r);
+  undo_save_block (r.start, size, size);
+  if (cur_bp->pieces)
+    {
+      astr as = get_buffer_region (cur_bp, r).as;
+      for (size_t i = 0; i < size; i++)
+        astr_set (as, i, func ((unsigned char) astr_get (as, i), i), 1);
+      piece_table_replace (cur_bp->pieces, r.start, size, astr_cstr (as), size);
+    }
+  else
+    for (size_t o = r.start; o < r.end; o++)
+      {
+        size_t realo = o_to_realo (cur_bp, o);
+        astr_set (cur_bp->text.as, realo,
+                  func ((unsigned char) astr_get (cur_bp->text.as, realo), o - r.start), 1);
+      }
+
+  buffer_changed (cur_bp, r.start, size, size);
+  set_buffer_modified (cur_bp, true);
+  return true;
+}
+
 char
 get_buffer_char (Buffer *bp, size_t o)
 {
+  if (bp->pieces)
+    return piece_table_get (bp->pieces, o);
   return astr_get (bp->text.as, o_to_realo (bp, o));
 }
 
 size_t
 buffer_prev_line (Buffer *bp, size_t o)
 {
+  if (bp->pieces)
+    {
+      size_t so = pieces_start_of_line (bp, o);
+      return so == 0 ? SIZE_MAX : pieces_start_of_line (bp, so - strlen (get_buffer_eol (bp)));
+    }
   return realo_to_o (bp, estr_prev_line (bp->text, o_to_realo (bp, o)));
 }
 
 size_t
 buffer_next_line (Buffer *bp, size_t o)
 {
+  if (bp->pieces)
+    {
+      size_t eo = pieces_end_of_line (bp, o);
+      return eo == piece_table_len (bp->pieces) ? SIZE_MAX : eo + strlen (get_buffer_eol (bp));
+    }
   return realo_to_o (bp, estr_next_line (bp->text, o_to_realo (bp, o)));
 }
 
 size_t
 buffer_start_of_line (Buffer *bp, size_t o)
 {
+  if (bp->pieces)
+    return pieces_start_of_line (bp, o);
   return realo_to_o (bp, estr_start_of_line (bp->text, o_to_realo (bp, o)));
 }
 
 size_t
 buffer_end_of_line (Buffer *bp, size_t o)
 {
+  if (bp->pieces)
+    return pieces_end_of_line (bp, o);
   return realo_to_o (bp, estr_end_of_line (bp->text, o_to_realo (bp, o)));
 }
 
 size_t
 get_buffer_line_o (Buffer *bp)
 {
+  if (bp->pieces)
+    return pieces_start_of_line (bp, bp->pt);
   return realo_to_o (bp, estr_start_of_line (bp->text, o_to_realo (bp, bp->pt)));
 }
 
@@ -237,21 +577,90 @@ get_buffer_eol (Buffer *bp)
   return bp->text.eol;
 }
 
+/*
+ * Return the number of EOLs in a region plus one, if the line index
+ * makes it cheap to find, or 0 otherwise.
+ */
+static size_t
+region_lines (Buffer *bp, Region r)
+{
+  if (bp->line_index == NULL)
+    return 0;
+
+  size_t start, n = line_index_line (bp->line_index, r.end, &start) -
+    line_index_line (bp->line_index, r.start, &start);
+
+  /* Don't count an EOL that starts before the region. */
+  const char *eol = get_buffer_eol (bp);
+  if (eol[1] != '\0' && r.start > 0 && r.start < r.end
+      && get_buffer_char (bp, r.start - 1) == eol[0]
+      && get_buffer_char (bp, r.start) == eol[1])
+    n--;
+  return n + 1;
+}
+
+BufferSpan
+buffer_span (Buffer *bp, Region r)
+{
+  return (BufferSpan) {.bp = bp, .o = r.start, .end = r.end};
+}
+
+/*
+ * Set `*s' and `*len' to the next contiguous chunk of a span, and
+ * return true, or return false if the span is exhausted.
+ */
+bool
+buffer_span_next (BufferSpan *sp, const char **s, size_t *len)
+{
+  Buffer *bp = sp->bp;
+  if (sp->o >= sp->end)
+    return false;
+
+  if (bp->pieces)
+    *s = piece_table_chunk (bp->pieces, sp->o, len);
+  else if (sp->o < bp->gapo)
+    {
+      *s = astr_cstr (bp->text.as) + sp->o;
+      *len = bp->gapo - sp->o;
+    }
+  else
+    {
+      *s = astr_cstr (bp->text.as) + sp->o + bp->gap;
+      *len = get_buffer_size (bp) - sp->o;
+    }
+  *len = MIN (*len, sp->end - sp->o);
+  sp->o += *len;
+  return true;
+}
+
+/*
+ * Append a region of a buffer to `es', converting EOLs if needed.
+ */
+estr
+append_buffer_region (estr es, Buffer *bp, Region r)
+{
+  if (!STREQ (es.eol, get_buffer_eol (bp)))
+    return estr_cat (es, get_buffer_region (bp, r));
+
+  size_t lines = region_lines (bp, r);
+  astr_reserve (es.as, astr_len (es.as) + get_region_size (r));
+  BufferSpan span = buffer_span (bp, r);
+  const char *s;
+  size_t len;
+  while (buffer_span_next (&span, &s, &len))
+    astr_cat_nstr (es.as, s, len);
+  es.lines = es.lines > 0 && lines > 0 ? es.lines + lines - 1 : 0;
+  return es;
+}
+
 /*
  * Copy a region of text into an allocated buffer.
  */
 estr
 get_buffer_region (Buffer *bp, Region r)
 {
-  astr as = astr_new ();
-  if (r.start < get_buffer_pt (bp))
-    astr_cat (as, astr_substr (get_buffer_pre_point (bp), r.start, MIN (r.end, get_buffer_pt (bp)) - r.start));
-  if (r.end > get_buffer_pt (bp))
-    {
-      size_t from = MAX (r.start, get_buffer_pt (bp));
-      astr_cat (as, astr_substr (get_buffer_post_point (bp), from - get_buffer_pt (bp), r.end - from));
-    }
-  return (estr) {.as = as, .eol = get_buffer_eol (bp)};
+  return append_buffer_region ((estr) {.as = astr_new (), .eol = get_buffer_eol (bp), .lines = 1},
+                               bp, r);
 }
 
 /*
@@ -261,7 +670,8 @@ int
 insert_char (int c)
 {
   const char ch = (char) c;
-  return replace_estr (false, (estr) {.as = astr_cat_nstr (astr_new (), &ch, 1), .eol = coding_eol_lf});
+  return replace_estr (false, (estr) {.as = astr_cat_nstr (astr_new (), &ch, 1), .eol = coding_eol_lf,
+                                      .lines = ch == '\n' ? 2 : 1});
 }
 
 bool
@@ -295,8 +705,7 @@ void
 insert_buffer (Buffer * bp)
 {
   /* Copy text to avoid problems when bp == cur_bp. */
-  insert_estr ((estr) {.as = astr_cpy (astr_new (), get_buffer_pre_point (bp)), .eol = get_buffer_eol (bp)});
-  insert_estr ((estr) {.as = astr_cpy (astr_new (), get_buffer_post_point (bp)), .eol = get_buffer_eol (bp)});
+  insert_estr (get_buffer_region (bp, region_new (0, get_buffer_size (bp))));
 }
 
 /*
@@ -307,6 +716,7 @@ Buffer *
 buffer_new (void)
 {
   Buffer *bp = (Buffer *) XZALLOC (Buffer);
+  buffer_changed (bp, 0, SIZE_MAX, 0);
   bp->text.as = astr_new ();
   bp->text.eol = coding_eol_lf;
   bp->dir = agetcwd ();
@@ -321,13 +731,14 @@ buffer_new (void)
 }
 
 /*
- * Unchain the buffer's markers.
+ * Unchain the buffer's markers, and free its undo deltas.
  */
 void
 free_buffer (Buffer * bp)
 {
   while (bp->markers)
     unchain_marker (bp->markers);
+  undo_free (bp);
 }
 
 /*
@@ -338,6 +749,8 @@ init_buffer (Buffer * bp)
 {
   if (get_variable_bool ("auto-fill-mode"))
     set_buffer_autofill (bp, true);
+  if (get_variable_bool ("%piece-table-mode"))
+    set_buffer_piece_table (bp, true);
 }
 
 /*
@@ -490,7 +903,7 @@ delete_region (const Region r)
   if (warn_if_readonly_buffer ())
     return false;
 
-  Marker *m = point_marker ();
+  Marker *m = weak_marker (point_marker ());
   goto_offset (r.start);
   replace_estr (get_region_size (r), estr_empty);
   goto_offset (get_marker_o (m));
@@ -679,6 +1092,14 @@ With a nil argument, kill the current buffer.")
   return ok;
 }
 
+SCM_DEFINE (G_buffer_marker_count, "buffer-marker-count", 0, 0, 0, (void), "\
+Return the number of markers in the current buffer.")
+{
+  size_t n = count_markers (cur_bp);
+  if (interactive)
+    minibuf_write ("%zu markers", n);
+  return scm_from_size_t (n);
+}
 
 Completion *
 make_buffer_completion (void)
@@ -797,10 +1218,19 @@ move_line (int n)
 size_t
 offset_to_line (Buffer *bp, size_t offset)
 {
-  size_t n = 0;
-  for (size_t o = 0; buffer_end_of_line (bp, o) < offset; o = buffer_next_line (bp, o))
-    n++;
-  return n;
+  size_t start;
+  return line_index_line (get_buffer_line_index (bp), offset, &start);
+}
+
+/*
+ * Return the offset of the start of line `n', or of the last line if
+ * there are fewer lines.
+ */
+size_t
+line_to_offset (Buffer *bp, size_t n)
+{
+  Line_index *li = get_buffer_line_index (bp);
+  return line_index_offset (li, MIN (n, line_index_lines (li) - 1));
 }
 
 void
@@ -821,5 +1251,7 @@ init_guile_buffer_procedures (void)
 {
 
 #include "buffer.x"
-  scm_c_export ("kill-buffer", NULL);
+  scm_c_export ("kill-buffer",
+                "buffer-marker-count",
+                NULL);
 }
@@ -31,9 +31,14 @@ FIELD_STR(filename)       /* The file being edited. */
 FIELD(Buffer *, next)     /* Next buffer in buffer list. */
 FIELD(size_t, goalc)      /* Goal column for previous/next-line commands. */
 FIELD(Marker *, mark)     /* The mark. */
-FIELD(Marker *, markers)  /* Markers list (updated whenever text is changed). */
+FIELD(Marker *, markers)  /* Root of the markers tree (updated whenever text is changed). */
 FIELD(Undo *, last_undop) /* Most recent undo delta. */
 FIELD(Undo *, next_undop) /* Next undo delta to apply. */
+FIELD(size_t, undo_size)  /* Bytes used by the undo deltas. */
+FIELD(size_t, tick)       /* Changed whenever the text is; unique to the buffer. */
+FIELD(size_t, dirty_start) /* Start of the text changed since redisplay, or SIZE_MAX. */
+FIELD(size_t, dirty_end)  /* Its end, or SIZE_MAX if all the text changed. */
+FIELD(size_t, dirty_old_end) /* Where it ended before it changed. */
 FIELD(char *, module)     /* Buffer-local Guile module's name. */
 FIELD(bool, modified)     /* Modified flag. */
 FIELD(bool, nosave)       /* The buffer need not be saved. */
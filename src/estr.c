@@ -28,6 +28,7 @@
 #include "astr.h"
 #include "estr.h"
 #include "memrmem.h"
+#include "memscan.h"
 
 
 /* Formats of end-of-line. */
@@ -41,46 +42,59 @@ void
 estr_init (void)
 {
   estr_empty = estr_new_astr (astr_new ());
+  estr_empty.lines = 1;
 }
 
 /* Maximum number of EOLs to check before deciding type. */
 #define MAX_EOL_CHECK_COUNT 3
-estr
-estr_new_astr (castr as)
+
+/*
+ * Determine the EOL type of `as' from its first few line endings.
+ */
+static const char *
+estr_detect_eol (castr as)
 {
-  bool first_eol = true;
-  size_t total_eols = 0;
-  estr es = (estr) {.as = astr_cpy (astr_new (), as), .eol = coding_eol_lf};
-  for (size_t i = 0; i < astr_len (as) && total_eols < MAX_EOL_CHECK_COUNT; i++)
+  const char *eol = coding_eol_lf;
+  const char *s = astr_cstr (as), *end = s + astr_len (as);
+  const char *lf = memchr (s, '\n', end - s);
+  for (size_t total_eols = 0; total_eols < MAX_EOL_CHECK_COUNT; total_eols++)
     {
-      char c = astr_get (as, i);
-      if (c == '\n' || c == '\r')
+      /* Only look for a CR before the next LF, so that text with LF
+         line endings is scanned once. */
+      if (lf != NULL && lf < s)
+        lf = memchr (s, '\n', end - s);
+      const char *cr = memchr (s, '\r', (lf ? lf : end) - s);
+      const char *this_eol_type;
+      if (cr == NULL && lf == NULL)
+        break;
+      else if (cr == NULL)
+        {
+          this_eol_type = coding_eol_lf;
+          s = lf + 1;
+        }
+      else if (cr + 1 < end && cr[1] == '\n')
+        {
+          this_eol_type = coding_eol_crlf;
+          s = cr + 2;
+        }
+      else
         {
-          const char *this_eol_type;
-          total_eols++;
-          if (c == '\n')
-            this_eol_type = coding_eol_lf;
-          else if (i == astr_len (as) - 1 || astr_get (as, i + 1) != '\n')
-            this_eol_type = coding_eol_cr;
-          else
-            {
-              this_eol_type = coding_eol_crlf;
-              i++;
-            }
-
-          if (first_eol)
-            { /* This is the first end-of-line. */
-              es.eol = this_eol_type;
-              first_eol = false;
-            }
-          else if (es.eol != this_eol_type)
-            { /* This EOL is different from the last; arbitrarily choose LF. */
-              es.eol = coding_eol_lf;
-              break;
-            }
+          this_eol_type = coding_eol_cr;
+          s = cr + 1;
         }
+
+      if (total_eols == 0)
+        eol = this_eol_type; /* This is the first end-of-line. */
+      else if (eol != this_eol_type)
+        return coding_eol_lf; /* This EOL is different from the last; arbitrarily choose LF. */
     }
-  return es;
+  return eol;
+}
+
+estr
+estr_new_astr (castr as)
+{
+  return (estr) {.as = astr_cpy (astr_new (), as), .eol = estr_detect_eol (as)};
 }
 
 size_t
@@ -108,8 +122,10 @@ estr_start_of_line (estr es, size_t o)
 size_t
 estr_end_of_line (estr es, size_t o)
 {
-  const char *next = memmem (astr_cstr (es.as) + o, astr_len (es.as) - o,
-                             es.eol, strlen (es.eol));
+  const char *s = astr_cstr (es.as) + o;
+  size_t len = astr_len (es.as) - o;
+  const char *next = es.eol[1] == '\0' ? memchr (s, es.eol[0], len) :
+    memmem (s, len, es.eol, strlen (es.eol));
   return next ? (size_t) (next - astr_cstr (es.as)) : astr_len (es.as);
 }
 
@@ -122,6 +138,11 @@ estr_line_len (estr es, size_t o)
 size_t
 estr_lines (estr es)
 {
+  if (es.lines > 0)
+    return es.lines - 1;
+  if (es.eol[1] == '\0')
+    return mem_count (astr_cstr (es.as), astr_len (es.as), es.eol[0]);
+
   size_t es_eol_len = strlen (es.eol);
   const char *s = astr_cstr (es.as), *next;
   size_t lines = 0;
@@ -132,11 +153,29 @@ estr_lines (estr es)
   return lines;
 }
 
-estr
-estr_replace_estr (estr es, size_t pos, estr src)
+size_t
+estr_len (estr es, const char *eol_type)
+{
+  if (strcmp (es.eol, eol_type) == 0)
+    return astr_len (es.as);
+  return astr_len (es.as) + estr_lines (es) * (strlen (eol_type) - strlen (es.eol));
+}
+
+/*
+ * Copy `src' into `es' at `pos', converting EOLs, and return the
+ * number of EOLs copied, or SIZE_MAX if they were not counted.
+ */
+static size_t
+copy_estr (estr es, size_t pos, estr src)
 {
+  if (strcmp (src.eol, es.eol) == 0)
+    { /* No conversion needed: copy in one go. */
+      astr_replace_nstr (es.as, pos, astr_cstr (src.as), astr_len (src.as));
+      return src.lines > 0 ? src.lines - 1 : SIZE_MAX;
+    }
+
   const char *s = astr_cstr (src.as);
-  size_t src_eol_len = strlen (src.eol), es_eol_len = strlen (es.eol);
+  size_t src_eol_len = strlen (src.eol), es_eol_len = strlen (es.eol), lines = 0;
   for (size_t len = astr_len (src.as); len > 0;)
     {
       const char *next = memmem (s, len, src.eol, src_eol_len);
@@ -151,8 +190,17 @@ estr_replace_estr (estr es, size_t pos, estr src)
           s += src_eol_len;
           len -= src_eol_len;
           pos += es_eol_len;
+          lines++;
         }
     }
+  return lines;
+}
+
+estr
+estr_replace_estr (estr es, size_t pos, estr src)
+{
+  copy_estr (es, pos, src);
+  es.lines = 0;
   return es;
 }
 
@@ -161,7 +209,9 @@ estr_cat (estr es, estr src)
 {
   size_t oldlen = astr_len (es.as);
   astr_insert (es.as, oldlen, estr_len (src, es.eol));
-  return estr_replace_estr (es, oldlen, src);
+  size_t lines = copy_estr (es, oldlen, src);
+  es.lines = es.lines > 0 && lines != SIZE_MAX ? es.lines + lines : 0;
+  return es;
 }
 
 estr
@@ -170,6 +220,6 @@ estr_readf (const char *filename)
   estr es = (estr) {.as = NULL, .eol = coding_eol_lf};
   astr as = astr_readf (filename);
   if (as)
-    es = estr_new_astr (as);
+    es = (estr) {.as = as, .eol = estr_detect_eol (as)};
   return es;
 }
@@ -25,6 +25,7 @@ struct estr
 {
   astr as;			/* String. */
   const char *eol;		/* EOL type. */
+  size_t lines;			/* Number of EOLs plus one, or 0 if not counted. */
 };
 
 extern estr estr_empty;
@@ -49,7 +50,10 @@ _GL_ATTRIBUTE_PURE size_t estr_lines (estr es);
 estr estr_replace_estr (estr es, size_t pos, estr src);
 estr estr_cat (estr es, estr src);
 
-#define estr_len(es, eol_type) astr_len (es.as) +  estr_lines (es) * (strlen (eol_type) - strlen (es.eol))
+/*
+ * Return the length of `es' when its EOLs are converted to `eol_type'.
+ */
+_GL_ATTRIBUTE_PURE size_t estr_len (estr es, const char *eol_type);
 
 /*
  * Read file contents into an estr.
@@ -66,7 +66,9 @@ void init_guile_bind_procedures (void);
 int insert_char (int c);
 bool delete_char (void);
 bool replace_estr (size_t del, estr es);
+bool replace_regions (const Region *r, const size_t *lens, size_t n, estr es);
 bool insert_estr (estr as);
+bool transform_region (Region r, int (*func) (int c, size_t i));
 #define FIELD(ty, field)                                \
   ty get_buffer_ ## field (const Buffer *bp);           \
   void set_buffer_ ## field (Buffer *bp, ty field);
@@ -77,8 +79,9 @@ bool insert_estr (estr as);
 #undef FIELD
 #undef FIELD_STR
 void set_buffer_text (Buffer *bp, estr es);
-castr get_buffer_pre_point (Buffer *bp);
-castr get_buffer_post_point (Buffer *bp);
+_GL_ATTRIBUTE_PURE bool get_buffer_piece_table (Buffer *bp);
+void set_buffer_piece_table (Buffer *bp, bool on);
+castr get_buffer_text_view (Buffer *bp, size_t from, size_t to, size_t *base);
 _GL_ATTRIBUTE_PURE size_t get_buffer_pt (Buffer *bp);
 _GL_ATTRIBUTE_PURE size_t get_buffer_size (Buffer * bp);
 _GL_ATTRIBUTE_PURE const char *get_buffer_eol (Buffer *bp);
@@ -109,6 +112,9 @@ void activate_mark (void);
 void deactivate_mark (void);
 size_t tab_width (Buffer * bp);
 estr get_buffer_region (Buffer *bp, Region r);
+estr append_buffer_region (estr es, Buffer *bp, Region r);
+BufferSpan buffer_span (Buffer *bp, Region r);
+bool buffer_span_next (BufferSpan *sp, const char **s, size_t *len);
 Buffer *create_auto_buffer (const char *name);
 Buffer *create_scratch_buffer (void);
 void kill_buffer (Buffer * kill_bp);
@@ -117,6 +123,7 @@ bool check_modified_buffer (Buffer * bp);
 bool move_char (int dir);
 bool move_line (int n);
 _GL_ATTRIBUTE_PURE size_t offset_to_line (Buffer *bp, size_t offset);
+_GL_ATTRIBUTE_PURE size_t line_to_offset (Buffer *bp, size_t n);
 void goto_offset (size_t o);
 void init_guile_buffer_procedures (void);
 
@@ -307,9 +314,15 @@ extern bool interactive;
 #include "marker.h"
 #undef FIELD
 Marker * marker_new (void);
+size_t get_marker_o (const Marker * marker);
+void set_marker_o (Marker * marker, size_t o);
+void adjust_markers (Buffer * bp, size_t o, size_t del, size_t newlen);
 void unchain_marker (const Marker * marker);
 void move_marker (Marker * marker, Buffer * bp, size_t o);
 Marker *copy_marker (const Marker * marker);
+Marker *weak_marker (Marker * marker);
+void release_weak_markers (void);
+size_t count_markers (Buffer * bp);
 Marker *point_marker (void);
 void push_mark (void);
 void pop_mark (void);
@@ -348,6 +361,7 @@ void init_guile_registers_procedures (void);
 
 /* search.c --------------------------------------------------------------- */
 void init_search (void);
+const Region *isearch_matches (Buffer *bp, size_t start, size_t end, size_t *n);
 void init_guile_search_procedures (void);
 
 /* term_curses.c ---------------------------------------------------------- */
@@ -375,6 +389,7 @@ castr term_minibuf_read (const char *prompt, const char *value, size_t pos,
                          Completion * cp, History * hp);
 
 /* term_redisplay.c ------------------------------------------------------- */
+void term_invalidate (void);
 void term_redraw_cursor (void);
 void term_redisplay (void);
 void term_finish (void);
@@ -385,6 +400,8 @@ void undo_start_sequence (void);
 void undo_end_sequence (void);
 void undo_save_block (size_t o, size_t osize, size_t size);
 void undo_set_unchanged (Undo *up);
+void undo_trim (Buffer *bp);
+void undo_free (Buffer *bp);
 void init_guile_undo_procedures (void);
 
 /* variables.c ------------------------------------------------------------ */
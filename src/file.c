@@ -232,8 +232,7 @@ find_file (const char *filename)
           set_buffer_text (bp, es);
 
           /* Reset undo history. */
-          set_buffer_next_undop (bp, NULL);
-          set_buffer_last_undop (bp, NULL);
+          undo_free (bp);
           set_buffer_modified (bp, false);
         }
     }
@@ -495,15 +494,13 @@ write_to_disk (Buffer * bp, const char *filename, mode_t mode)
     return -1;
 
   int ret = 0;
-  castr as = get_buffer_pre_point (bp);
-  ssize_t written = write (fd, astr_cstr (as), astr_len (as));
-  if (written < 0 || (size_t) written != astr_len (as))
-    ret = written;
-  else
+  BufferSpan span = buffer_span (bp, region_new (0, get_buffer_size (bp)));
+  const char *s;
+  size_t len;
+  while (ret == 0 && buffer_span_next (&span, &s, &len))
     {
-      as = get_buffer_post_point (bp);
-      written = write (fd, astr_cstr (as), astr_len (as));
-      if (written < 0 || (size_t) written != astr_len (as))
+      ssize_t written = write (fd, s, len);
+      if (written < 0 || (size_t) written != len)
         ret = written;
     }
 
@@ -168,6 +168,16 @@ automatically breaks the line at a previous space.")
   return SCM_BOOL_T;
 }
 
+SCM_DEFINE (G_piece_table_mode, "piece-table-mode", 0, 0, 0, (void), "\
+Toggle Piece Table mode.\n\
+In Piece Table mode, the buffer's text is held as a list of pieces\n\
+of the original and inserted text, so moving point is cheap and edits\n\
+never copy the original text.")
+{
+  set_buffer_piece_table (cur_bp, !get_buffer_piece_table (cur_bp));
+  return SCM_BOOL_T;
+}
+
 SCM_DEFINE (G_set_fill_column, "set-fill-column", 0, 1, 0, (SCM n), "\
 Set `fill-column' to specified argument.\n\
 Use C-u followed by a number to specify a column.\n\
@@ -529,7 +539,11 @@ static void
 astr_append_region (astr s)
 {
   activate_mark ();
-  astr_cat (s, get_buffer_region (cur_bp, calculate_the_region ()).as);
+  BufferSpan span = buffer_span (cur_bp, calculate_the_region ());
+  const char *text;
+  size_t len;
+  while (buffer_span_next (&span, &text, &len))
+    astr_cat_nstr (s, text, len);
 }
 
 static bool
@@ -552,7 +566,7 @@ transpose_subr (bool (*move_func) (int dir))
 
   /* Mark the beginning of first string. */
   push_mark ();
-  Marker *m1 = point_marker ();
+  Marker *m1 = weak_marker (point_marker ());
 
   /* Check to make sure we can go forwards twice. */
   if (!move_func (1) || !move_func (1))
@@ -591,7 +605,7 @@ transpose_subr (bool (*move_func) (int dir))
   astr as2 = NULL;
   Marker *m2;
   if (move_func == move_line)
-    m2 = point_marker ();
+    m2 = weak_marker (point_marker ());
   else
     {
       /* Mark the end of second string. */
@@ -599,7 +613,7 @@ transpose_subr (bool (*move_func) (int dir))
 
       /* Backward. */
       move_func (-1);
-      m2 = point_marker ();
+      m2 = weak_marker (point_marker ());
 
       /* Save and delete 2nd marked region. */
       as2 = astr_new ();
@@ -779,7 +793,7 @@ The paragraph marked is the one that contains point or follows point.")
 SCM_DEFINE (G_fill_paragraph, "fill-paragraph", 0, 0, 0, (void), "\
 Fill paragraph at or after point.")
 {
-  Marker *m = point_marker ();
+  Marker *m = weak_marker (point_marker ());
   long fill_column;
 
   undo_start_sequence ();
@@ -787,7 +801,7 @@ Fill paragraph at or after point.")
   G_forward_paragraph (scm_from_int (1));
   if (is_empty_line ())
     previous_line ();
-  Marker *m_end = point_marker ();
+  Marker *m_end = weak_marker (point_marker ());
 
   G_backward_paragraph (scm_from_int (1));
   if (is_empty_line ())
@@ -813,36 +827,52 @@ Fill paragraph at or after point.")
   undo_end_sequence ();
   return SCM_BOOL_T;
 }
+
+static int
+upcase_char (int c, size_t i _GL_UNUSED_PARAMETER)
+{
+  return toupper (c);
+}
+
+static int
+downcase_char (int c, size_t i _GL_UNUSED_PARAMETER)
+{
+  return tolower (c);
+}
+
+static int
+capitalize_char (int c, size_t i)
+{
+  return i == 0 ? toupper (c) : tolower (c);
+}
+
 static bool
-setcase_word (int rcase)
+setcase_word (int (*func) (int, size_t))
 {
   if (!iswordchar (following_char ()))
     if (!move_word (1) || !move_word (-1))
       return false;
 
-  astr as = astr_new ();
-  char c;
-  for (size_t i = get_buffer_pt (cur_bp) - get_buffer_line_o (cur_bp);
-       i < buffer_line_len (cur_bp, get_buffer_pt (cur_bp)) &&
-         iswordchar ((int) (c = get_buffer_char (cur_bp, get_buffer_line_o (cur_bp) + i)));
-       i++)
-    astr_cat_char (as, c);
-
-  if (astr_len (as) > 0)
+  size_t o = get_buffer_pt (cur_bp), end;
+  for (end = o;
+       end < buffer_end_of_line (cur_bp, o) && iswordchar ((int) get_buffer_char (cur_bp, end));
+       end++)
+    ;
+
+  if (end > o)
     {
-      astr_recase (as, rcase);
-      replace_estr (astr_len (as), estr_new_astr (as));
+      if (!transform_region (region_new (o, end), func))
+        return false;
+      goto_offset (end);
     }
 
-  set_buffer_modified (cur_bp, true);
-
   return true;
 }
 
 static bool
 setcase_word_lowercase (void)
 {
-  return setcase_word (case_lower);
+  return setcase_word (downcase_char);
 }
 
 SCM_DEFINE (G_downcase_word, "downcase-word", 0, 1, 0, (SCM n), "\
@@ -855,7 +885,7 @@ Convert following word (or @i{arg} words) to lower case, moving over.")
 static bool
 setcase_word_uppercase (void)
 {
-  return setcase_word (case_upper);
+  return setcase_word (upcase_char);
 }
 
 SCM_DEFINE (G_upcase_word, "upcase-word", 0, 1, 0, (SCM n), "\
@@ -868,7 +898,7 @@ Convert following word (or @i{arg} words) to upper case, moving over.")
 static bool
 setcase_word_capitalize (void)
 {
-  return setcase_word (case_capitalized);
+  return setcase_word (capitalize_char);
 }
 
 SCM_DEFINE (G_capitalize_word, "capitalize-word", 0, 1, 0, (SCM n), "\
@@ -884,40 +914,24 @@ and the rest lower case.")
  * Set the region case.
  */
 static SCM
-setcase_region (int (*func) (int))
+setcase_region (int (*func) (int, size_t))
 {
   if (warn_if_readonly_buffer () || warn_if_no_mark ())
     return SCM_BOOL_F;
 
-  Region r = calculate_the_region ();
-  undo_start_sequence ();
-
-  Marker *m = point_marker ();
-  goto_offset (r.start);
-  for (size_t size = get_region_size (r); size > 0; size--)
-    {
-      char c = func (following_char ());
-      delete_char ();
-      insert_char (c);
-    }
-  goto_offset (get_marker_o (m));
-  unchain_marker (m);
-
-  undo_end_sequence ();
-
-  return SCM_BOOL_T;
+  return scm_from_bool (transform_region (calculate_the_region (), func));
 }
 
 SCM_DEFINE (G_upcase_region, "upcase-region", 0, 0, 0, (void), "\
 Convert the region to upper case.")
 {
-  return setcase_region (toupper);
+  return setcase_region (upcase_char);
 }
 
 SCM_DEFINE (G_downcase_region, "downcase-region", 0, 0, 0, (void), "\
 Convert the region to lower case.")
 {
-  return setcase_region (tolower);
+  return setcase_region (downcase_char);
 }
 
 static void
@@ -927,23 +941,29 @@ write_shell_output (va_list ap)
 }
 
 typedef struct {
-  astr in;
+  BufferSpan in;
+  const char *chunk;
+  size_t chunk_len;
   astr out;
-  size_t done;
   char buf[BUFSIZ];
 } pipe_data;
 
 static const void *
 prepare_write (size_t *n, void *priv)
 {
-  *n = astr_len (((pipe_data *) priv)->in) - ((pipe_data *) priv)->done;
-  return *n ? astr_cstr (((pipe_data *) priv)->in) + ((pipe_data *) priv)->done : NULL;
+  pipe_data *inout = (pipe_data *) priv;
+  if (inout->chunk_len == 0
+      && !buffer_span_next (&inout->in, &inout->chunk, &inout->chunk_len))
+    return NULL;
+  *n = inout->chunk_len;
+  return inout->chunk;
 }
 
 static void
 done_write (void *data _GL_UNUSED_PARAMETER, size_t n, void *priv)
 {
-  ((pipe_data *) priv)->done += n;
+  ((pipe_data *) priv)->chunk += n;
+  ((pipe_data *) priv)->chunk_len -= n;
 }
 
 static void *
@@ -960,10 +980,11 @@ done_read (void *data, size_t n, void *priv)
 }
 
 static SCM
-pipe_command (castr cmd, astr input, bool do_insert, bool do_replace)
+pipe_command (castr cmd, Region input, bool do_insert, bool do_replace)
 {
   const char *prog_argv[] = { "/bin/sh", "-c", astr_cstr (cmd), NULL };
-  pipe_data inout = { .in = input, .out = astr_new (), .done = 0 };
+  pipe_data inout = { .in = buffer_span (cur_bp, input),
+                      .out = astr_reserve (astr_new (), BUFSIZ) };
   if (pipe_filter_ii_execute (PACKAGE_NAME, "/bin/sh", prog_argv, true, false,
                               prepare_write, done_write, prepare_read, done_read,
                               &inout) != 0)
@@ -1046,7 +1067,7 @@ says to insert the output in the current buffer.")
     insert = scm_to_bool (ginsert);
 
   if (cmd != NULL)
-    return pipe_command (cmd, astr_new (), insert, false);
+    return pipe_command (cmd, region_new (0, 0), insert, false);
   return SCM_BOOL_T;
 }
 
@@ -1088,7 +1109,7 @@ The output is available in that buffer in both cases.")
       if (warn_if_no_mark ())
         ok = SCM_BOOL_F;
       else
-        ok = pipe_command (cmd, get_buffer_region (cur_bp, calculate_the_region ()).as, insert, true);
+        ok = pipe_command (cmd, calculate_the_region (), insert, true);
     }
   return ok;
 }
@@ -1109,7 +1130,7 @@ On blank line, delete all surrounding blank lines, leaving just one.\n\
 On isolated blank line, delete that one.\n\
 On nonblank line, delete any immediately following blank lines.")
 {
-  Marker *m = point_marker ();
+  Marker *m = weak_marker (point_marker ());
   Region r;
   r.start = r.end = get_buffer_line_o (cur_bp);
 
@@ -909,6 +909,10 @@ guile_load (const char *filename)
 	       _guile_load_body, (void *) filename,
 	       _guile_default_error_handler, (void *) filename,
 	       NULL, NULL);
+
+  /* Scripts are loaded outside any command, so release the temporary
+     markers they made here. */
+  release_weak_markers ();
 }
 
 
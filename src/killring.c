@@ -43,14 +43,23 @@ static void
 kill_ring_push (estr es)
 {
   if (kill_ring_text.as == NULL)
-    kill_ring_text = (estr) {.as = astr_new (), .eol = coding_eol_lf};
-  estr_cat (kill_ring_text, es);
+    kill_ring_text = (estr) {.as = astr_new (), .eol = coding_eol_lf, .lines = 1};
+  astr_reserve (kill_ring_text.as, astr_len (kill_ring_text.as) + estr_len (es, kill_ring_text.eol));
+  kill_ring_text = estr_cat (kill_ring_text, es);
+}
+
+static void
+kill_ring_push_region (Region r)
+{
+  if (kill_ring_text.as == NULL)
+    kill_ring_text = (estr) {.as = astr_new (), .eol = get_buffer_eol (cur_bp), .lines = 1};
+  kill_ring_text = append_buffer_region (kill_ring_text, cur_bp, r);
 }
 
 static bool
 copy_or_kill_region (bool kill, Region r)
 {
-  kill_ring_push (get_buffer_region (cur_bp, r));
+  kill_ring_push_region (r);
 
   if (kill)
     {
@@ -90,7 +90,7 @@ fill_break_line (void)
       size_t break_col = 0;
 
       /* Save point. */
-      Marker *m = point_marker ();
+      Marker *m = weak_marker (point_marker ());
 
       /* Move cursor back to fill column */
       size_t old_col = get_buffer_pt (cur_bp) - get_buffer_line_o (cur_bp);
@@ -282,7 +282,7 @@ does nothing.")
     target_goalc = 0;
   else
     { /* Find goalc in previous non-blank line. */
-      Marker *m = point_marker ();
+      Marker *m = weak_marker (point_marker ());
 
       previous_nonblank_goalc ();
 
@@ -335,7 +335,7 @@ static size_t
 previous_line_indent (void)
 {
   size_t cur_indent;
-  Marker *m = point_marker ();
+  Marker *m = weak_marker (point_marker ());
 
   G_previous_line (scm_from_int (1));
   G_beginning_of_line ();
@@ -380,7 +380,7 @@ Indentation is done using the `indent-for-tab-command' function.")
   undo_start_sequence ();
   if (insert_newline ())
     {
-      Marker *m = point_marker ();
+      Marker *m = weak_marker (point_marker ());
 
       /* Check where last non-blank goalc is. */
       previous_nonblank_goalc ();
@@ -0,0 +1,258 @@
+/* Line indexes
+
+   Copyright (c) 2012 Michael L. Gran
+
+   This file is part of Michael Gran's unofficial fork of GNU Zile.
+
+   GNU Zile is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3, or (at your option)
+   any later version.
+
+   GNU Zile is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with GNU Zile; see the file COPYING.  If not, write to the
+   Free Software Foundation, Fifth Floor, 51 Franklin Street, Boston,
+   MA 02111-1301, USA.  */
+
+#include <config.h>
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include "xalloc.h"
+
+#include "lineindex.h"
+
+/*
+ * The index is a treap ordered by line number: each node is a line,
+ * and carries the total length and number of lines in its subtree.
+ */
+typedef struct Line Line;
+struct Line
+{
+  Line *left, *right;
+  uint32_t prio;		/* Heap priority; larger is nearer the root. */
+  size_t len;			/* Length of this line. */
+  size_t sum;			/* Total length of the subtree. */
+  size_t count;			/* Number of lines in the subtree. */
+};
+
+struct Line_index
+{
+  Line *root;
+  uint32_t seed;		/* State of the priority generator. */
+};
+
+Line_index *
+line_index_new (void)
+{
+  Line_index *li = (Line_index *) XZALLOC (Line_index);
+  li->seed = 2463534242U;
+  return li;
+}
+
+static uint32_t
+next_prio (Line_index *li)
+{
+  /* xorshift32 */
+  li->seed ^= li->seed << 13;
+  li->seed ^= li->seed >> 17;
+  li->seed ^= li->seed << 5;
+  return li->seed;
+}
+
+static inline size_t
+line_sum (Line *l)
+{
+  return l ? l->sum : 0;
+}
+
+static inline size_t
+line_count (Line *l)
+{
+  return l ? l->count : 0;
+}
+
+static inline void
+update (Line *l)
+{
+  l->sum = l->len + line_sum (l->left) + line_sum (l->right);
+  l->count = 1 + line_count (l->left) + line_count (l->right);
+}
+
+/*
+ * Split `l' into its first `n' lines and the rest.
+ */
+static void
+split (Line *l, size_t n, Line **a, Line **b)
+{
+  if (l == NULL)
+    *a = *b = NULL;
+  else if (line_count (l->left) < n)
+    {
+      split (l->right, n - line_count (l->left) - 1, &l->right, b);
+      update (l);
+      *a = l;
+    }
+  else
+    {
+      split (l->left, n, a, &l->left);
+      update (l);
+      *b = l;
+    }
+}
+
+static Line *
+merge (Line *a, Line *b)
+{
+  if (a == NULL)
+    return b;
+  else if (b == NULL)
+    return a;
+  else if (a->prio > b->prio)
+    {
+      a->right = merge (a->right, b);
+      update (a);
+      return a;
+    }
+  else
+    {
+      b->left = merge (a, b->left);
+      update (b);
+      return b;
+    }
+}
+
+static void
+update_all (Line *l)
+{
+  if (l)
+    {
+      update_all (l->left);
+      update_all (l->right);
+      update (l);
+    }
+}
+
+/*
+ * Build a treap from `n' line lengths in linear time, by keeping the
+ * right spine on a stack.
+ */
+static Line *
+build (Line_index *li, const size_t *lens, size_t n)
+{
+  if (n == 0)
+    return NULL;
+
+  Line **stack = (Line **) xmalloc (n * sizeof (Line *));
+  size_t sp = 0;
+  for (size_t i = 0; i < n; i++)
+    {
+      Line *l = (Line *) XZALLOC (Line);
+      l->prio = next_prio (li);
+      l->len = lens[i];
+      Line *last = NULL;
+      while (sp > 0 && stack[sp - 1]->prio < l->prio)
+        last = stack[--sp];
+      l->left = last;
+      if (sp > 0)
+        stack[sp - 1]->right = l;
+      stack[sp++] = l;
+    }
+  Line *root = stack[0];
+  free (stack);
+  update_all (root);
+  return root;
+}
+
+size_t
+line_index_lines (Line_index *li)
+{
+  return line_count (li->root);
+}
+
+size_t
+line_index_line (Line_index *li, size_t o, size_t *start)
+{
+  size_t n = 0, s = 0;
+  Line *l = li->root;
+  while (l)
+    {
+      size_t left = line_sum (l->left);
+      if (o < s + left)
+        l = l->left;
+      else if (o < s + left + l->len || l->right == NULL)
+        {
+          n += line_count (l->left);
+          s += left;
+          break;
+        }
+      else
+        {
+          n += line_count (l->left) + 1;
+          s += left + l->len;
+          l = l->right;
+        }
+    }
+  *start = s;
+  return n;
+}
+
+size_t
+line_index_offset (Line_index *li, size_t n)
+{
+  size_t s = 0;
+  Line *l = li->root;
+  while (l)
+    {
+      if (n < line_count (l->left))
+        l = l->left;
+      else if (n == line_count (l->left))
+        return s + line_sum (l->left);
+      else
+        {
+          n -= line_count (l->left) + 1;
+          s += line_sum (l->left) + l->len;
+          l = l->right;
+        }
+    }
+  return s;
+}
+
+void
+line_index_replace (Line_index *li, size_t n, size_t count,
+                    const size_t *lens, size_t nlens)
+{
+  Line *a, *b, *c;
+  split (li->root, n, &a, &b);
+  split (b, count, &b, &c);
+  li->root = merge (merge (a, build (li, lens, nlens)), c);
+}
+
+void
+line_index_extend (Line_index *li, size_t n, size_t len)
+{
+  Line *l = li->root;
+  while (l)
+    {
+      l->sum += len;
+      if (n < line_count (l->left))
+        l = l->left;
+      else if (n == line_count (l->left))
+        {
+          l->len += len;
+          return;
+        }
+      else
+        {
+          n -= line_count (l->left) + 1;
+          l = l->right;
+        }
+    }
+  assert (0);
+}
@@ -0,0 +1,53 @@
+/* Line indexes
+
+   Copyright (c) 2012 Michael L. Gran
+
+   This file is part of Michael Gran's unofficial fork of GNU Zile.
+
+   GNU Zile is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3, or (at your option)
+   any later version.
+
+   GNU Zile is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with GNU Zile; see the file COPYING.  If not, write to the
+   Free Software Foundation, Fifth Floor, 51 Franklin Street, Boston,
+   MA 02111-1301, USA.  */
+
+/*
+ * A line index records the length of each line of a text, including
+ * its EOL, in a balanced tree, so that converting between offsets and
+ * line numbers, and replacing a run of lines, take O(log n) time.
+ */
+typedef struct Line_index Line_index;
+
+Line_index *line_index_new (void);
+_GL_ATTRIBUTE_PURE size_t line_index_lines (Line_index *li);
+
+/*
+ * Return the number of the line containing offset `o', and set
+ * `*start' to the offset at which it starts.
+ */
+size_t line_index_line (Line_index *li, size_t o, size_t *start);
+
+/*
+ * Return the offset of the start of line `n'.
+ */
+_GL_ATTRIBUTE_PURE size_t line_index_offset (Line_index *li, size_t n);
+
+/*
+ * Replace the `count' lines starting at line `n' with `nlens' lines
+ * whose lengths are given by `lens'.
+ */
+void line_index_replace (Line_index *li, size_t n, size_t count,
+                         const size_t *lens, size_t nlens);
+
+/*
+ * Add `len' to the length of line `n'.
+ */
+void line_index_extend (Line_index *li, size_t n, size_t len);
@@ -36,6 +36,10 @@
 #include "hash.h"
 #include "gl_xlist.h"
 
+/* Let gc.h register the threads that occur starts with the collector. */
+#ifdef HAVE_GC_THREADS
+#define GC_THREADS
+#endif
 #ifdef HAVE_GC_H
 #include <gc.h>
 #else
@@ -73,6 +77,20 @@ struct Region
   size_t end;		/* The region end. */
 };
 
+typedef struct BufferSpan BufferSpan;
+
+/*
+ * A read-only view of part of a buffer's text, read in contiguous
+ * chunks by buffer_span_next without copying.  It is only valid until
+ * the buffer is next changed.
+ */
+struct BufferSpan
+{
+  Buffer *bp;		/* The buffer. */
+  size_t o;		/* Start of the text not yet read. */
+  size_t end;		/* End of the span. */
+};
+
 enum
 {
   COMPLETION_NOTMATCHED,
@@ -23,15 +23,21 @@
 #include <config.h>
 
 #include <assert.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <ctype.h>
 #include "gl_linked_list.h"
+#include "minmax.h"
 
 #include "main.h"
 #include "extern.h"
 
 /*
  * Structure
+ *
+ * A buffer's markers are kept in a treap ordered by offset.  Each
+ * marker stores its offset relative to its parent's, so that shifting
+ * all the markers after an edit only touches the root of a subtree.
  */
 
 struct Marker
@@ -39,6 +45,10 @@ struct Marker
 #define FIELD(ty, name) ty name;
 #include "marker.h"
 #undef FIELD
+  size_t o;		/* Offset, relative to the parent's if any. */
+  Marker *left, *right, *parent;
+  uint32_t prio;	/* Heap priority; larger is nearer the root. */
+  size_t count;		/* Number of markers in the subtree. */
 };
 
 #define FIELD(ty, field)                         \
@@ -48,53 +58,230 @@ struct Marker
 #include "marker.h"
 #undef FIELD
 
+static uint32_t
+next_prio (void)
+{
+  static uint32_t seed = 2463534242U;
+  /* xorshift32 */
+  seed ^= seed << 13;
+  seed ^= seed >> 17;
+  seed ^= seed << 5;
+  return seed;
+}
+
 Marker *
 marker_new (void)
 {
-  return (Marker *) XZALLOC (Marker);
+  Marker *marker = (Marker *) XZALLOC (Marker);
+  marker->prio = next_prio ();
+  return marker;
 }
 
-void
-unchain_marker (const Marker * marker)
+size_t
+get_marker_o (const Marker * marker)
 {
-  if (!marker->bp)
-    return;
+  size_t o = 0;
+  for (const Marker *m = marker; m; m = m->parent)
+    o += m->o;
+  return o;
+}
 
-  Marker *prev = NULL;
-  for (Marker *m = get_buffer_markers (marker->bp); m; m = m->next)
+/*
+ * Helpers for detaching and attaching subtrees.  A detached subtree's
+ * root holds its absolute offset.
+ */
+static Marker *
+detach (Marker *m, size_t base)
+{
+  if (m)
     {
-      if (m == marker)
-        {
-          if (prev)
-            prev->next = m->next;
-          else
-            set_buffer_markers (m->bp, m->next);
+      m->o += base;
+      m->parent = NULL;
+    }
+  return m;
+}
+
+static Marker *
+attach (Marker *m, Marker *parent)
+{
+  if (m)
+    {
+      m->o -= parent->o;
+      m->parent = parent;
+    }
+  return m;
+}
 
-          m->bp = NULL;
-          break;
+static size_t
+subtree_count (const Marker *t)
+{
+  return t ? t->count : 0;
+}
+
+/* Recount the subtree of `t' after its children have changed. */
+static Marker *
+recount (Marker *t)
+{
+  t->count = 1 + subtree_count (t->left) + subtree_count (t->right);
+  return t;
+}
+
+/*
+ * Split detached tree `t' into markers at or before `o', and those
+ * after it.
+ */
+static void
+split (Marker *t, size_t o, Marker **l, Marker **r)
+{
+  if (t == NULL)
+    *l = *r = NULL;
+  else if (t->o <= o)
+    {
+      split (detach (t->right, t->o), o, &t->right, r);
+      attach (t->right, t);
+      *l = recount (t);
+    }
+  else
+    {
+      split (detach (t->left, t->o), o, l, &t->left);
+      attach (t->left, t);
+      *r = recount (t);
+    }
+}
+
+/*
+ * Join detached trees `a' and `b', where no marker in `a' is after
+ * any in `b'.
+ */
+static Marker *
+merge (Marker *a, Marker *b)
+{
+  if (a == NULL)
+    return b;
+  else if (b == NULL)
+    return a;
+  else if (a->prio > b->prio)
+    {
+      a->right = attach (merge (detach (a->right, a->o), b), a);
+      return recount (a);
+    }
+  b->left = attach (merge (a, detach (b->left, b->o)), b);
+  return recount (b);
+}
+
+/*
+ * Set every marker in detached tree `t' to `o'.
+ */
+static void
+collapse (Marker *t, size_t o)
+{
+  if (t)
+    {
+      t->o = o;
+      collapse (t->left, 0);
+      collapse (t->right, 0);
+    }
+}
+
+static void
+insert_marker (Marker * marker, size_t o)
+{
+  assert (marker->bp != NULL);
+  Marker *l, *r;
+  *marker = (Marker) {.bp = marker->bp, .o = o, .prio = marker->prio,
+                       .count = 1};
+  split (get_buffer_markers (marker->bp), o, &l, &r);
+  set_buffer_markers (marker->bp, merge (merge (l, marker), r));
+}
+
+static void
+remove_marker (Marker * marker)
+{
+  size_t o = get_marker_o (marker);
+  Marker *parent = marker->parent;
+  Marker *m = merge (detach (marker->left, o), detach (marker->right, o));
+  if (parent == NULL)
+    set_buffer_markers (marker->bp, m);
+  else
+    {
+      if (m)
+        {
+          m->o -= o - marker->o;
+          m->parent = parent;
         }
-      prev = m;
+      if (parent->left == marker)
+        parent->left = m;
+      else
+        parent->right = m;
+      for (; parent; parent = parent->parent)
+        parent->count--;
     }
 }
 
 void
-move_marker (Marker * marker, Buffer * bp, size_t o)
+set_marker_o (Marker * marker, size_t o)
+{
+  if (marker->bp)
+    {
+      remove_marker (marker);
+      insert_marker (marker, o);
+    }
+  else
+    marker->o = o;
+}
+
+/*
+ * Adjust the markers of `bp' for the replacement of `del' chars at
+ * `o' by `newlen' chars.  Markers after the edit move by the change
+ * in length, without ever moving back before `o'.
+ */
+void
+adjust_markers (Buffer * bp, size_t o, size_t del, size_t newlen)
 {
-  if (bp != marker->bp)
+  if (del == newlen)
+    return;
+
+  Marker *a, *b = NULL, *c;
+  split (get_buffer_markers (bp), o, &a, &c);
+  if (del > newlen)
     {
-      /* Unchain with the previous pointed buffer.  */
-      unchain_marker (marker);
+      Marker *t = c;
+      split (t, o + del - newlen, &b, &c);
+      collapse (b, o);
+    }
+  if (c)
+    c->o = c->o + newlen - del;
+  set_buffer_markers (bp, merge (merge (a, b), c));
+}
+
+void
+unchain_marker (const Marker * marker)
+{
+  if (!marker->bp)
+    return;
 
-      /* Change the buffer.  */
-      marker->bp = bp;
+  Marker *m = (Marker *) marker;
+  size_t o = get_marker_o (m);
+  remove_marker (m);
+  *m = (Marker) {.o = o, .prio = m->prio};
+}
 
-      /* Chain with the new buffer.  */
-      marker->next = get_buffer_markers (bp);
-      set_buffer_markers (bp, marker);
+void
+move_marker (Marker * marker, Buffer * bp, size_t o)
+{
+  /* Unchain with the previous pointed buffer.  */
+  unchain_marker (marker);
+
+  /* A marker into no buffer just holds its offset. */
+  if (bp == NULL)
+    {
+      marker->o = o;
+      return;
     }
 
-  /* Change the point.  */
-  marker->o = o;
+  /* Chain with the new buffer at the new point.  */
+  marker->bp = bp;
+  insert_marker (marker, o);
 }
 
 Marker *
@@ -104,7 +291,7 @@ copy_marker (const Marker * m)
   if (m)
     {
       marker = marker_new ();
-      move_marker (marker, m->bp, m->o);
+      move_marker (marker, m->bp, get_marker_o (m));
     }
   return marker;
 }
@@ -117,6 +304,59 @@ point_marker (void)
   return marker;
 }
 
+size_t
+count_markers (Buffer * bp)
+{
+  return subtree_count (get_buffer_markers (bp));
+}
+
+
+/*
+ * Weak markers
+ */
+
+static Marker **weak_markers = NULL;
+static size_t weak_markers_len = 0, weak_markers_max = 0;
+
+/*
+ * Make `marker' temporary: it is unchained when the current command,
+ * or the script being loaded, finishes, if that has not already been
+ * done.
+ */
+Marker *
+weak_marker (Marker * marker)
+{
+  if (marker == NULL)
+    return NULL;
+
+  /* When the list is full, first forget the markers already
+     unchained, so that code running outside any command, such as a
+     long script, does not grow it without bound. */
+  if (weak_markers_len == weak_markers_max)
+    {
+      size_t n = 0;
+      for (size_t i = 0; i < weak_markers_len; i++)
+        if (weak_markers[i]->bp)
+          weak_markers[n++] = weak_markers[i];
+      weak_markers_len = n;
+      if (weak_markers_len >= weak_markers_max / 2)
+        {
+          weak_markers_max = MAX (weak_markers_max * 2, 16);
+          weak_markers = xrealloc (weak_markers, weak_markers_max * sizeof (Marker *));
+        }
+    }
+  weak_markers[weak_markers_len++] = marker;
+  return marker;
+}
+
+void
+release_weak_markers (void)
+{
+  for (size_t i = 0; i < weak_markers_len; i++)
+    unchain_marker (weak_markers[i]);
+  weak_markers_len = 0;
+}
+
 
 /*
  * Mark ring
@@ -124,6 +364,8 @@ point_marker (void)
 
 static gl_list_t mark_ring = NULL;	/* Mark ring. */
 
+#define MARK_RING_MAX 16	/* Maximum size of the mark ring. */
+
 /* Push the current mark to the mark-ring. */
 void
 push_mark (void)
@@ -142,6 +384,13 @@ push_mark (void)
       gl_list_add_last (mark_ring, m);
     }
 
+  /* Drop the oldest mark if the ring is full.  */
+  if (gl_list_size (mark_ring) > MARK_RING_MAX)
+    {
+      unchain_marker (gl_list_get_at (mark_ring, 0));
+      gl_list_remove_at (mark_ring, 0);
+    }
+
   G_set_mark ();
 }
 
@@ -19,6 +19,4 @@
    Free Software Foundation, Fifth Floor, 51 Franklin Street, Boston,
    MA 02111-1301, USA.  */
 
-FIELD(Marker *, next)		/* Used to chain all markers in the buffer. */
-FIELD(size_t, o)		/* Marker offset within buffer. */
 FIELD(Buffer *, bp)		/* Buffer that marker points into. */
@@ -0,0 +1,125 @@
+/* Literal substring search
+
+   Copyright (c) 2012 Michael L. Gran
+
+   This file is part of Michael Gran's unofficial fork of GNU Zile.
+
+   GNU Zile is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3, or (at your option)
+   any later version.
+
+   GNU Zile is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with GNU Zile; see the file COPYING.  If not, write to the
+   Free Software Foundation, Fifth Floor, 51 Franklin Street, Boston,
+   MA 02111-1301, USA.  */
+
+#include <config.h>
+
+#include <ctype.h>
+#include <limits.h>
+#include <string.h>
+
+#include "memscan.h"
+#include "memfind.h"
+
+/* Both searches are Boyer-Moore-Horspool, using the vectorized byte
+   scanners to jump straight to the next position where the byte
+   compared first matches, and the skip table to move on after a
+   failed comparison. */
+
+static bool
+equal (const char *a, const char *b, size_t n, bool icase)
+{
+  if (!icase)
+    return memcmp (a, b, n) == 0;
+  for (size_t i = 0; i < n; i++)
+    if (tolower ((unsigned char) a[i]) != tolower ((unsigned char) b[i]))
+      return false;
+  return true;
+}
+
+/*
+ * Set `skip[c]' to `i' for byte `c' (in both cases if `icase').
+ */
+static void
+set_skip (size_t *skip, unsigned char c, size_t i, bool icase)
+{
+  skip[c] = i;
+  if (icase)
+    {
+      skip[tolower (c)] = i;
+      skip[toupper (c)] = i;
+    }
+}
+
+const char *
+mem_find (const char *s, size_t n, const char *t, size_t m, bool icase)
+{
+  if (m == 0)
+    return s;
+  if (m > n)
+    return NULL;
+  if (!icase)
+    return memmem (s, n, t, m);
+
+  /* The skip for each byte is the distance from its last occurrence
+     in `t', not counting the last byte, to the end of `t'. */
+  size_t skip[UCHAR_MAX + 1];
+  for (size_t c = 0; c <= UCHAR_MAX; c++)
+    skip[c] = m;
+  for (size_t i = 0; i + 1 < m; i++)
+    set_skip (skip, t[i], m - 1 - i, icase);
+
+  unsigned char last = t[m - 1];
+  char c1 = tolower (last), c2 = toupper (last);
+  for (size_t i = 0; i + m <= n;)
+    {
+      const char *p = mem_chr2 (s + i + m - 1, n - (i + m - 1), c1, c2);
+      if (p == NULL)
+        return NULL;
+      i = p - s - (m - 1);
+      if (equal (s + i, t, m - 1, icase))
+        return s + i;
+      i += skip[(unsigned char) s[i + m - 1]];
+    }
+  return NULL;
+}
+
+const char *
+mem_rfind (const char *s, size_t n, const char *t, size_t m, bool icase)
+{
+  if (m == 0)
+    return s + n;
+  if (m > n)
+    return NULL;
+
+  /* The skip for each byte is the distance from the start of `t' to
+     its first occurrence in `t', not counting the first byte. */
+  size_t skip[UCHAR_MAX + 1];
+  for (size_t c = 0; c <= UCHAR_MAX; c++)
+    skip[c] = m;
+  for (size_t i = m - 1; i > 0; i--)
+    set_skip (skip, t[i], i, icase);
+
+  unsigned char first = t[0];
+  char c1 = icase ? tolower (first) : first, c2 = icase ? toupper (first) : first;
+  for (size_t i = n - m;;)
+    {
+      const char *p = mem_rchr2 (s, i + 1, c1, c2);
+      if (p == NULL)
+        return NULL;
+      i = p - s;
+      if (equal (s + i + 1, t + 1, m - 1, icase))
+        return s + i;
+      size_t d = skip[(unsigned char) s[i]];
+      if (d > i)
+        return NULL;
+      i -= d;
+    }
+}
@@ -0,0 +1,34 @@
+/* Literal substring search
+
+   Copyright (c) 2012 Michael L. Gran
+
+   This file is part of Michael Gran's unofficial fork of GNU Zile.
+
+   GNU Zile is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3, or (at your option)
+   any later version.
+
+   GNU Zile is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with GNU Zile; see the file COPYING.  If not, write to the
+   Free Software Foundation, Fifth Floor, 51 Franklin Street, Boston,
+   MA 02111-1301, USA.  */
+
+#include <stdbool.h>
+
+/*
+ * Return the first occurrence of the `m' bytes at `t' in the `n'
+ * bytes at `s', or NULL.  If `icase' is true, ignore case.
+ */
+_GL_ATTRIBUTE_PURE const char *mem_find (const char *s, size_t n, const char *t, size_t m, bool icase);
+
+/*
+ * Return the last occurrence of the `m' bytes at `t' in the `n'
+ * bytes at `s', or NULL.  If `icase' is true, ignore case.
+ */
+_GL_ATTRIBUTE_PURE const char *mem_rfind (const char *s, size_t n, const char *t, size_t m, bool icase);
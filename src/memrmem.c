@@ -29,18 +29,26 @@
 #include <string.h>
 
 #include "memrmem.h"
+#include "memscan.h"
 
 
 const char *
 memrmem (const char *s, size_t slen, const char *t, size_t tlen)
 {
-  if (slen >= tlen)
+  if (tlen == 0)
+    return s + slen;
+  if (slen < tlen)
+    return NULL;
+
+  /* Find each candidate by its first byte, scanning backwards. */
+  for (size_t n = slen - tlen + 1; n > 0;)
     {
-      size_t i = slen - tlen;
-      do
-        if (memcmp (s + i, t, tlen) == 0)
-          return s + i;
-      while (i-- != 0);
+      const char *p = mem_rchr (s, n, t[0]);
+      if (p == NULL)
+        break;
+      if (memcmp (p + 1, t + 1, tlen - 1) == 0)
+        return p;
+      n = p - s;
     }
   return NULL;
 }
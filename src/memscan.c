@@ -0,0 +1,266 @@
+/* Vectorized byte scanning
+
+   Copyright (c) 2012 Michael L. Gran
+
+   This file is part of Michael Gran's unofficial fork of GNU Zile.
+
+   GNU Zile is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3, or (at your option)
+   any later version.
+
+   GNU Zile is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with GNU Zile; see the file COPYING.  If not, write to the
+   Free Software Foundation, Fifth Floor, 51 Franklin Street, Boston,
+   MA 02111-1301, USA.  */
+
+#include <config.h>
+
+#include <stddef.h>
+#include "minmax.h"
+
+#include "memscan.h"
+
+/* On x86, use SSE2 or AVX2 when the CPU has them; otherwise fall back
+   to plain loops.  The vector loops use unaligned loads and leave any
+   tail shorter than a vector to the scalar code. */
+#if defined __GNUC__ && (defined __x86_64__ || defined __i386__)
+#define HAVE_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+static const char *
+rchr_scalar (const char *s, size_t n, char c)
+{
+  while (n-- > 0)
+    if (s[n] == c)
+      return s + n;
+  return NULL;
+}
+
+static const char *
+chr2_scalar (const char *s, size_t n, char c1, char c2)
+{
+  for (size_t i = 0; i < n; i++)
+    if (s[i] == c1 || s[i] == c2)
+      return s + i;
+  return NULL;
+}
+
+static const char *
+rchr2_scalar (const char *s, size_t n, char c1, char c2)
+{
+  while (n-- > 0)
+    if (s[n] == c1 || s[n] == c2)
+      return s + n;
+  return NULL;
+}
+
+static size_t
+count_scalar (const char *s, size_t n, char c)
+{
+  size_t count = 0;
+  for (size_t i = 0; i < n; i++)
+    count += s[i] == c;
+  return count;
+}
+
+#ifdef HAVE_X86_SIMD
+__attribute__ ((target ("sse2"))) static const char *
+rchr_sse2 (const char *s, size_t n, char c)
+{
+  const __m128i needle = _mm_set1_epi8 (c);
+  for (; n >= 16; n -= 16)
+    {
+      __m128i v = _mm_loadu_si128 ((const __m128i *) (s + n - 16));
+      unsigned mask = _mm_movemask_epi8 (_mm_cmpeq_epi8 (v, needle));
+      if (mask)
+        return s + n - 16 + (31 - __builtin_clz (mask));
+    }
+  return rchr_scalar (s, n, c);
+}
+
+__attribute__ ((target ("sse2"))) static const char *
+chr2_sse2 (const char *s, size_t n, char c1, char c2)
+{
+  const __m128i n1 = _mm_set1_epi8 (c1), n2 = _mm_set1_epi8 (c2);
+  size_t i = 0;
+  for (; n - i >= 16; i += 16)
+    {
+      __m128i v = _mm_loadu_si128 ((const __m128i *) (s + i));
+      unsigned mask = _mm_movemask_epi8 (_mm_or_si128 (_mm_cmpeq_epi8 (v, n1),
+                                                       _mm_cmpeq_epi8 (v, n2)));
+      if (mask)
+        return s + i + __builtin_ctz (mask);
+    }
+  return chr2_scalar (s + i, n - i, c1, c2);
+}
+
+__attribute__ ((target ("sse2"))) static const char *
+rchr2_sse2 (const char *s, size_t n, char c1, char c2)
+{
+  const __m128i n1 = _mm_set1_epi8 (c1), n2 = _mm_set1_epi8 (c2);
+  for (; n >= 16; n -= 16)
+    {
+      __m128i v = _mm_loadu_si128 ((const __m128i *) (s + n - 16));
+      unsigned mask = _mm_movemask_epi8 (_mm_or_si128 (_mm_cmpeq_epi8 (v, n1),
+                                                       _mm_cmpeq_epi8 (v, n2)));
+      if (mask)
+        return s + n - 16 + (31 - __builtin_clz (mask));
+    }
+  return rchr2_scalar (s, n, c1, c2);
+}
+
+__attribute__ ((target ("sse2"))) static size_t
+count_sse2 (const char *s, size_t n, char c)
+{
+  const __m128i needle = _mm_set1_epi8 (c), zero = _mm_setzero_si128 ();
+  size_t count = 0, i = 0;
+  while (n - i >= 16)
+    {
+      /* Count in bytes for at most 255 vectors, then sum them. */
+      __m128i acc = zero;
+      for (size_t blocks = MIN ((n - i) / 16, 255); blocks > 0; blocks--, i += 16)
+        acc = _mm_sub_epi8 (acc, _mm_cmpeq_epi8 (_mm_loadu_si128 ((const __m128i *) (s + i)), needle));
+      __m128i sums = _mm_sad_epu8 (acc, zero);
+      count += _mm_cvtsi128_si32 (sums) + _mm_extract_epi16 (sums, 4);
+    }
+  return count + count_scalar (s + i, n - i, c);
+}
+
+__attribute__ ((target ("avx2"))) static const char *
+rchr_avx2 (const char *s, size_t n, char c)
+{
+  const __m256i needle = _mm256_set1_epi8 (c);
+  for (; n >= 32; n -= 32)
+    {
+      __m256i v = _mm256_loadu_si256 ((const __m256i *) (s + n - 32));
+      unsigned mask = _mm256_movemask_epi8 (_mm256_cmpeq_epi8 (v, needle));
+      if (mask)
+        return s + n - 32 + (31 - __builtin_clz (mask));
+    }
+  return rchr_sse2 (s, n, c);
+}
+
+__attribute__ ((target ("avx2"))) static const char *
+chr2_avx2 (const char *s, size_t n, char c1, char c2)
+{
+  const __m256i n1 = _mm256_set1_epi8 (c1), n2 = _mm256_set1_epi8 (c2);
+  size_t i = 0;
+  for (; n - i >= 32; i += 32)
+    {
+      __m256i v = _mm256_loadu_si256 ((const __m256i *) (s + i));
+      unsigned mask = _mm256_movemask_epi8 (_mm256_or_si256 (_mm256_cmpeq_epi8 (v, n1),
+                                                             _mm256_cmpeq_epi8 (v, n2)));
+      if (mask)
+        return s + i + __builtin_ctz (mask);
+    }
+  return chr2_sse2 (s + i, n - i, c1, c2);
+}
+
+__attribute__ ((target ("avx2"))) static const char *
+rchr2_avx2 (const char *s, size_t n, char c1, char c2)
+{
+  const __m256i n1 = _mm256_set1_epi8 (c1), n2 = _mm256_set1_epi8 (c2);
+  for (; n >= 32; n -= 32)
+    {
+      __m256i v = _mm256_loadu_si256 ((const __m256i *) (s + n - 32));
+      unsigned mask = _mm256_movemask_epi8 (_mm256_or_si256 (_mm256_cmpeq_epi8 (v, n1),
+                                                             _mm256_cmpeq_epi8 (v, n2)));
+      if (mask)
+        return s + n - 32 + (31 - __builtin_clz (mask));
+    }
+  return rchr2_sse2 (s, n, c1, c2);
+}
+
+__attribute__ ((target ("avx2"))) static size_t
+count_avx2 (const char *s, size_t n, char c)
+{
+  const __m256i needle = _mm256_set1_epi8 (c), zero = _mm256_setzero_si256 ();
+  size_t count = 0, i = 0;
+  while (n - i >= 32)
+    {
+      __m256i acc = zero;
+      for (size_t blocks = MIN ((n - i) / 32, 255); blocks > 0; blocks--, i += 32)
+        acc = _mm256_sub_epi8 (acc, _mm256_cmpeq_epi8 (_mm256_loadu_si256 ((const __m256i *) (s + i)), needle));
+      __m256i sums = _mm256_sad_epu8 (acc, zero);
+      __m128i t = _mm_add_epi64 (_mm256_castsi256_si128 (sums), _mm256_extracti128_si256 (sums, 1));
+      count += _mm_cvtsi128_si32 (t) + _mm_extract_epi16 (t, 4);
+    }
+  return count + count_sse2 (s + i, n - i, c);
+}
+#endif
+
+static const char *(*rchr_impl) (const char *s, size_t n, char c) = NULL;
+static const char *(*chr2_impl) (const char *s, size_t n, char c1, char c2) = NULL;
+static const char *(*rchr2_impl) (const char *s, size_t n, char c1, char c2) = NULL;
+static size_t (*count_impl) (const char *s, size_t n, char c) = NULL;
+
+/*
+ * Choose the implementations for this processor, unless that was
+ * done already.
+ */
+void
+mem_scan_init (void)
+{
+  if (count_impl != NULL)
+    return;
+  rchr_impl = rchr_scalar;
+  chr2_impl = chr2_scalar;
+  rchr2_impl = rchr2_scalar;
+  count_impl = count_scalar;
+#ifdef HAVE_X86_SIMD
+  __builtin_cpu_init ();
+  if (__builtin_cpu_supports ("avx2"))
+    {
+      rchr_impl = rchr_avx2;
+      chr2_impl = chr2_avx2;
+      rchr2_impl = rchr2_avx2;
+      count_impl = count_avx2;
+    }
+  else if (__builtin_cpu_supports ("sse2"))
+    {
+      rchr_impl = rchr_sse2;
+      chr2_impl = chr2_sse2;
+      rchr2_impl = rchr2_sse2;
+      count_impl = count_sse2;
+    }
+#endif
+}
+
+const char *
+mem_rchr (const char *s, size_t n, char c)
+{
+  if (rchr_impl == NULL)
+    mem_scan_init ();
+  return rchr_impl (s, n, c);
+}
+
+const char *
+mem_chr2 (const char *s, size_t n, char c1, char c2)
+{
+  if (chr2_impl == NULL)
+    mem_scan_init ();
+  return chr2_impl (s, n, c1, c2);
+}
+
+const char *
+mem_rchr2 (const char *s, size_t n, char c1, char c2)
+{
+  if (rchr2_impl == NULL)
+    mem_scan_init ();
+  return rchr2_impl (s, n, c1, c2);
+}
+
+size_t
+mem_count (const char *s, size_t n, char c)
+{
+  if (count_impl == NULL)
+    mem_scan_init ();
+  return count_impl (s, n, c);
+}
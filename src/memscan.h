@@ -0,0 +1,49 @@
+/* Vectorized byte scanning
+
+   Copyright (c) 2012 Michael L. Gran
+
+   This file is part of Michael Gran's unofficial fork of GNU Zile.
+
+   GNU Zile is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3, or (at your option)
+   any later version.
+
+   GNU Zile is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with GNU Zile; see the file COPYING.  If not, write to the
+   Free Software Foundation, Fifth Floor, 51 Franklin Street, Boston,
+   MA 02111-1301, USA.  */
+
+/*
+ * Choose the fastest implementations for this processor.  They are
+ * otherwise chosen on first use, so this must be called before the
+ * functions below are used from more than one thread.
+ */
+void mem_scan_init (void);
+
+/*
+ * Return the last occurrence of `c' in the `n' bytes at `s', or NULL.
+ */
+_GL_ATTRIBUTE_PURE const char *mem_rchr (const char *s, size_t n, char c);
+
+/*
+ * Return the first occurrence of `c1' or `c2' in the `n' bytes at
+ * `s', or NULL.
+ */
+_GL_ATTRIBUTE_PURE const char *mem_chr2 (const char *s, size_t n, char c1, char c2);
+
+/*
+ * Return the last occurrence of `c1' or `c2' in the `n' bytes at
+ * `s', or NULL.
+ */
+_GL_ATTRIBUTE_PURE const char *mem_rchr2 (const char *s, size_t n, char c1, char c2);
+
+/*
+ * Return the number of occurrences of `c' in the `n' bytes at `s'.
+ */
+_GL_ATTRIBUTE_PURE size_t mem_count (const char *s, size_t n, char c);
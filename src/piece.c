@@ -0,0 +1,273 @@
+/* Piece tables
+
+   Copyright (c) 2012 Michael L. Gran
+
+   This file is part of Michael Gran's unofficial fork of GNU Zile.
+
+   GNU Zile is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3, or (at your option)
+   any later version.
+
+   GNU Zile is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with GNU Zile; see the file COPYING.  If not, write to the
+   Free Software Foundation, Fifth Floor, 51 Franklin Street, Boston,
+   MA 02111-1301, USA.  */
+
+#include <config.h>
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include "xalloc.h"
+#include "minmax.h"
+
+#include "astr.h"
+#include "piece.h"
+#include "memscan.h"
+
+typedef struct Piece Piece;
+struct Piece
+{
+  bool add;			/* Text is in the add buffer, not the original. */
+  size_t start;			/* Offset of the text in its buffer. */
+  size_t len;			/* Length of the text. */
+};
+
+struct Piece_table
+{
+  castr orig;			/* The original text; never modified. */
+  astr add;			/* Inserted text; only ever appended to. */
+  Piece *pieces;		/* The pieces, in order. */
+  size_t npieces;		/* Number of pieces in use. */
+  size_t maxpieces;		/* Number of pieces allocated. */
+  size_t len;			/* Total length of the text. */
+  size_t last;			/* Index of the last piece looked up... */
+  size_t last_o;		/* ...and its offset in the text. */
+};
+
+static void
+insert_piece (Piece_table *pt, size_t i, Piece p)
+{
+  if (pt->npieces == pt->maxpieces)
+    {
+      pt->maxpieces = MAX (pt->maxpieces * 2, 16);
+      pt->pieces = xrealloc (pt->pieces, pt->maxpieces * sizeof (Piece));
+    }
+  memmove (pt->pieces + i + 1, pt->pieces + i, (pt->npieces - i) * sizeof (Piece));
+  pt->pieces[i] = p;
+  pt->npieces++;
+}
+
+Piece_table *
+piece_table_new (castr orig)
+{
+  Piece_table *pt = (Piece_table *) XZALLOC (Piece_table);
+  pt->orig = orig;
+  pt->add = astr_new ();
+  pt->len = astr_len (orig);
+  if (pt->len > 0)
+    insert_piece (pt, 0, (Piece) {.add = false, .start = 0, .len = pt->len});
+  return pt;
+}
+
+size_t
+piece_table_len (Piece_table *pt)
+{
+  return pt->len;
+}
+
+static inline const char *
+piece_text (Piece_table *pt, Piece *p)
+{
+  return astr_cstr (p->add ? pt->add : pt->orig) + p->start;
+}
+
+/*
+ * Return the index of the piece containing offset `o', or the number
+ * of pieces if `o' is the end of the text, and set `*start' to the
+ * offset of that piece.  The search starts from the last piece found,
+ * so sequential access costs O(1) per call.
+ */
+static size_t
+find_piece (Piece_table *pt, size_t o, size_t *start)
+{
+  size_t i = pt->last, ps = pt->last_o;
+  while (i > 0 && o < ps)
+    ps -= pt->pieces[--i].len;
+  while (i < pt->npieces && o >= ps + pt->pieces[i].len)
+    ps += pt->pieces[i++].len;
+  pt->last = i;
+  pt->last_o = ps;
+  *start = ps;
+  return i;
+}
+
+/*
+ * Make a piece boundary at offset `o', and return the index of the
+ * piece that starts there.
+ */
+static size_t
+split_piece (Piece_table *pt, size_t o)
+{
+  size_t ps, i = find_piece (pt, o, &ps);
+  if (i < pt->npieces && o > ps)
+    {
+      Piece *p = &pt->pieces[i];
+      size_t n = o - ps;
+      insert_piece (pt, i + 1, (Piece) {.add = p->add, .start = p->start + n, .len = p->len - n});
+      pt->pieces[i].len = n;
+      pt->last = ++i;
+      pt->last_o = o;
+    }
+  return i;
+}
+
+char
+piece_table_get (Piece_table *pt, size_t o)
+{
+  size_t ps, i = find_piece (pt, o, &ps);
+  assert (i < pt->npieces);
+  return piece_text (pt, &pt->pieces[i])[o - ps];
+}
+
+void
+piece_table_replace (Piece_table *pt, size_t o, size_t del, const char *s, size_t n)
+{
+  assert (o + del <= pt->len);
+
+  /* When typing, extend the piece holding the previous insertion. */
+  if (del == 0 && o > 0 && n > 0)
+    {
+      size_t ps, i = find_piece (pt, o - 1, &ps);
+      Piece *p = &pt->pieces[i];
+      if (p->add && ps + p->len == o && p->start + p->len == astr_len (pt->add))
+        {
+          astr_cat_nstr (pt->add, s, n);
+          p->len += n;
+          pt->len += n;
+          return;
+        }
+    }
+
+  /* Cut out the deleted pieces. */
+  size_t first = split_piece (pt, o);
+  size_t last = split_piece (pt, o + del);
+  if (last > first)
+    {
+      memmove (pt->pieces + first, pt->pieces + last, (pt->npieces - last) * sizeof (Piece));
+      pt->npieces -= last - first;
+    }
+
+  if (n > 0)
+    {
+      insert_piece (pt, first, (Piece) {.add = true, .start = astr_len (pt->add), .len = n});
+      astr_cat_nstr (pt->add, s, n);
+    }
+  else if (first > 0 && first < pt->npieces)
+    { /* Rejoin the pieces either side of a deletion if possible. */
+      Piece *p = &pt->pieces[first - 1], *q = &pt->pieces[first];
+      if (p->add == q->add && p->start + p->len == q->start)
+        {
+          o -= p->len;
+          p->len += q->len;
+          memmove (q, q + 1, (pt->npieces - first - 1) * sizeof (Piece));
+          pt->npieces--;
+          first--;
+        }
+    }
+
+  pt->len = pt->len + n - del;
+  pt->last = first;
+  pt->last_o = o;
+}
+
+const char *
+piece_table_chunk (Piece_table *pt, size_t o, size_t *len)
+{
+  size_t ps, i = find_piece (pt, o, &ps);
+  assert (i < pt->npieces);
+  *len = pt->pieces[i].len - (o - ps);
+  return piece_text (pt, &pt->pieces[i]) + (o - ps);
+}
+
+astr
+piece_table_cat (astr as, Piece_table *pt, size_t o, size_t n)
+{
+  assert (o + n <= pt->len);
+  astr_reserve (as, astr_len (as) + n);
+  size_t ps, i = find_piece (pt, o, &ps);
+  for (; n > 0; i++, ps = o)
+    {
+      Piece *p = &pt->pieces[i];
+      size_t len = MIN (n, p->len - (o - ps));
+      astr_cat_nstr (as, piece_text (pt, p) + (o - ps), len);
+      o += len;
+      n -= len;
+    }
+  return as;
+}
+
+/*
+ * Return true if `s' occurs at `o'.
+ */
+static bool
+match_at (Piece_table *pt, size_t o, const char *s, size_t n)
+{
+  if (o + n > pt->len)
+    return false;
+  for (size_t i = 0; i < n; i++)
+    if (piece_table_get (pt, o + i) != s[i])
+      return false;
+  return true;
+}
+
+size_t
+piece_table_find (Piece_table *pt, size_t o, const char *s, size_t n)
+{
+  size_t ps, i = find_piece (pt, o, &ps);
+  for (; i < pt->npieces; ps += pt->pieces[i++].len)
+    {
+      const char *text = piece_text (pt, &pt->pieces[i]);
+      size_t from = o > ps ? o - ps : 0;
+      const char *next;
+      while ((next = memchr (text + from, s[0], pt->pieces[i].len - from)) != NULL)
+        {
+          size_t found = ps + (next - text);
+          if (match_at (pt, found, s, n))
+            return found;
+          from = next - text + 1;
+        }
+    }
+  return SIZE_MAX;
+}
+
+size_t
+piece_table_rfind (Piece_table *pt, size_t o, const char *s, size_t n)
+{
+  assert (o <= pt->len);
+  if (o < n)
+    return SIZE_MAX;
+  size_t last = o - n, ps, i = find_piece (pt, last, &ps);
+  for (;;)
+    {
+      Piece *p = &pt->pieces[i];
+      const char *text = piece_text (pt, p);
+      const char *prev;
+      for (size_t j = MIN (last - ps, p->len - 1) + 1;
+           (prev = mem_rchr (text, j, s[0])) != NULL;
+           j = prev - text)
+        if (match_at (pt, ps + (prev - text), s, n))
+          return ps + (prev - text);
+      if (i == 0)
+        break;
+      ps -= pt->pieces[--i].len;
+    }
+  return SIZE_MAX;
+}
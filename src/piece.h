@@ -0,0 +1,66 @@
+/* Piece tables
+
+   Copyright (c) 2012 Michael L. Gran
+
+   This file is part of Michael Gran's unofficial fork of GNU Zile.
+
+   GNU Zile is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3, or (at your option)
+   any later version.
+
+   GNU Zile is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with GNU Zile; see the file COPYING.  If not, write to the
+   Free Software Foundation, Fifth Floor, 51 Franklin Street, Boston,
+   MA 02111-1301, USA.  */
+
+/*
+ * A piece table holds text as a sequence of pieces, each of which
+ * refers either to the original text, which is never modified, or to
+ * an append-only buffer holding all inserted text.  Edits only touch
+ * the piece list, so the original text is never copied.
+ */
+typedef struct Piece_table Piece_table;
+
+/*
+ * Make a piece table whose original text is `orig'.  `orig' is not
+ * copied, and must not be modified afterwards.
+ */
+Piece_table *piece_table_new (castr orig);
+
+_GL_ATTRIBUTE_PURE size_t piece_table_len (Piece_table *pt);
+char piece_table_get (Piece_table *pt, size_t o);
+
+/*
+ * Replace `del' chars at `o' with the `n' chars at `s'.
+ */
+void piece_table_replace (Piece_table *pt, size_t o, size_t del,
+                          const char *s, size_t n);
+
+/*
+ * Return the longest contiguous run of text starting at `o', and set
+ * `*len' to its length.
+ */
+const char *piece_table_chunk (Piece_table *pt, size_t o, size_t *len);
+
+/*
+ * Append the `n' chars at `o' to `as'.
+ */
+astr piece_table_cat (astr as, Piece_table *pt, size_t o, size_t n);
+
+/*
+ * Return the offset of the first occurrence of `s' at or after `o',
+ * or SIZE_MAX if there is none.
+ */
+size_t piece_table_find (Piece_table *pt, size_t o, const char *s, size_t n);
+
+/*
+ * Return the offset of the last occurrence of `s' that ends at or
+ * before `o', or SIZE_MAX if there is none.
+ */
+size_t piece_table_rfind (Piece_table *pt, size_t o, const char *s, size_t n);
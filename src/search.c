@@ -25,10 +25,16 @@
 #include <libguile.h>
 #include <stdlib.h>
 #include <ctype.h>
+#include <limits.h>
+#include <pthread.h>
 #include <regex.h>
+#include <unistd.h>
 
 #include "main.h"
 #include "extern.h"
+#include "memfind.h"
+#include "memrmem.h"
+#include "memscan.h"
 
 /* Return true if there are no upper-case letters in the given string.
    If `regex' is true, ignore escaped characters. */
@@ -49,46 +55,357 @@ no_upper (const char *s, size_t len, int regex)
 }
 
 static const char *re_find_err = NULL;
+static size_t match_start;	/* Start of the last match found. */
+static struct re_registers *match_regs; /* Its groups, for a regexp. */
 
+/*
+ * Cache of compiled patterns, keyed by pattern text and syntax, so
+ * that repeated searches do not recompile.  The least recently used
+ * pattern is freed when the cache is full.
+ */
+#define PATTERN_CACHE_SIZE 8
+
+typedef struct
+{
+  astr text;                        /* Pattern text, or NULL if unused. */
+  reg_syntax_t syntax;              /* Syntax it was compiled with. */
+  struct re_pattern_buffer pattern; /* The compiled pattern. */
+  struct re_registers regs;         /* Match registers, reused. */
+  unsigned long used;               /* When it was last used. */
+} Cached_pattern;
+
+static Cached_pattern pattern_cache[PATTERN_CACHE_SIZE];
+static unsigned long pattern_clock = 0;
+
+/*
+ * Return the compiled form of `n', or NULL on error, setting
+ * `re_find_err'.
+ */
+static Cached_pattern *
+compile_pattern (const char *n, size_t nsize, reg_syntax_t syntax)
+{
+  Cached_pattern *cp = &pattern_cache[0];
+  for (size_t i = 0; i < PATTERN_CACHE_SIZE; i++)
+    {
+      Cached_pattern *p = &pattern_cache[i];
+      if (p->text && p->syntax == syntax && astr_len (p->text) == nsize
+          && memcmp (astr_cstr (p->text), n, nsize) == 0)
+        {
+          p->used = ++pattern_clock;
+          re_find_err = NULL;
+          return p;
+        }
+      if (p->text == NULL || (cp->text != NULL && p->used < cp->used))
+        cp = p;
+    }
+
+  /* Evict the least recently used pattern. */
+  if (cp->text)
+    {
+      regfree (&cp->pattern);
+      free (cp->regs.start);
+      free (cp->regs.end);
+    }
+  memset (cp, 0, sizeof (*cp));
+
+  cp->pattern.fastmap = (char *) xmalloc (1 << CHAR_BIT);
+  re_set_syntax (syntax);
+  re_find_err = re_compile_pattern (n, (int) nsize, &cp->pattern);
+  if (re_find_err)
+    {
+      regfree (&cp->pattern);
+      memset (cp, 0, sizeof (*cp));
+      return NULL;
+    }
+  cp->text = astr_cat_nstr (astr_new (), n, nsize);
+  cp->syntax = syntax;
+  cp->used = ++pattern_clock;
+  return cp;
+}
+
+/*
+ * Search for the literal string `n', as find_substr does.
+ */
 static int
-find_substr (castr as1, castr as2, const char *n, size_t nsize, size_t from, size_t to,
+find_literal (castr as, size_t base, const char *n, size_t nsize, size_t from, size_t to,
+              bool forward, bool icase)
+{
+  const char *s = astr_cstr (as);
+  const char *p;
+  if (forward)
+    {
+      p = mem_find (s + from - base, MIN (astr_len (as) + base, to + nsize) - from,
+                    n, nsize, icase);
+      if (p == NULL)
+        return -1;
+      match_start = p - s + base;
+      return (int) (match_start + nsize);
+    }
+  if (to == from)
+    return -1;
+  p = mem_rfind (s + from - base, MIN (astr_len (as) + base, to - 1 + nsize) - from,
+                 n, nsize, icase);
+  if (p == NULL)
+    return -1;
+  match_start = p - s + base;
+  return (int) match_start;
+}
+
+/*
+ * Return the start of the last match of `cp' in `s' that starts
+ * between `from' and `to' - 1, or -1.  Rather than retry the matcher
+ * at each position going backwards, search forwards through windows
+ * working back from `to', each twice the size of the last, and take
+ * the last match in the first window that has one.
+ */
+#define BACKWARD_WINDOW 256
+static int
+search_backward (Cached_pattern *cp, const char *s, size_t len, size_t from, size_t to)
+{
+  size_t end = to, window = BACKWARD_WINDOW;
+  while (end > from)
+    {
+      size_t start = end - MIN (window, end - from);
+      int last = -1, pos = -1;
+      for (size_t o = start;
+           o < end && (pos = re_search (&cp->pattern, s, (int) len, (int) o,
+                                        (int) (end - 1 - o), &cp->regs)) >= 0;
+           o = pos + 1)
+        last = pos;
+      if (last >= 0)
+        {
+          /* Fill in the registers for the match found. */
+          re_match (&cp->pattern, s, (int) len, last, &cp->regs);
+          return last;
+        }
+      if (pos == -2)
+        break;
+      end = start;
+      window *= 2;
+    }
+  return -1;
+}
+
+/*
+ * Search for `n' in the text `as', which starts at buffer offset
+ * `base', for a match starting between `from' and `to' (forwards) or
+ * `to' - 1 (backwards).  Offsets given and returned are buffer
+ * offsets; `match_regs' are relative to `as'.
+ */
+static int
+find_substr (castr as, size_t base, const char *n, size_t nsize, size_t from, size_t to,
              bool forward, bool notbol, bool noteol, bool regex, bool icase)
 {
+  if (!regex)
+    {
+      re_find_err = NULL;
+      match_regs = NULL;
+      return find_literal (as, base, n, nsize, from, to, forward, icase);
+    }
+
   int ret = -1;
-  struct re_pattern_buffer pattern;
-  struct re_registers search_regs;
   reg_syntax_t syntax = RE_SYNTAX_EMACS;
-
-  memset (&pattern, 0, sizeof (pattern));
-
-  /* if (!regex)
-     syntax |= RE_PLAIN; */
   if (icase)
     syntax |= RE_ICASE;
-  re_set_syntax (syntax);
-  search_regs.num_regs = 1;
-
-  re_find_err = re_compile_pattern (n, (int) nsize, &pattern);
-  pattern.not_bol = notbol;
-  pattern.not_eol = noteol;
-  if (!re_find_err)
-    /* FIXME: The current implementation memcpys the two strings into
-       a freshly malloced block, i.e. is horribly inefficient for
-       large buffers. */
-    ret = re_search_2 (&pattern,
-                       astr_cstr (as1), (int) astr_len (as1),
-                       astr_cstr (as2), (int) astr_len (as2),
-                       forward ? from : to - 1,
-                       forward ? (to - from) : -(to - 1 - from),
-                       &search_regs,
-                       (int) astr_len (as1) + astr_len (as2));
+
+  Cached_pattern *cp = compile_pattern (n, nsize, syntax);
+  if (cp)
+    {
+      cp->pattern.not_bol = notbol || base > 0;
+      cp->pattern.not_eol = noteol;
+      if (forward)
+        ret = re_search (&cp->pattern, astr_cstr (as), (int) astr_len (as),
+                         from - base, to - from, &cp->regs);
+      else
+        ret = search_backward (cp, astr_cstr (as), astr_len (as), from - base, to - base);
+    }
 
   if (ret >= 0)
-    ret = forward ? search_regs.end[0] : ret;
+    {
+      match_start = cp->regs.start[0] + base;
+      match_regs = &cp->regs;
+      ret = (forward ? cp->regs.end[0] : ret) + base;
+    }
 
   return ret;
 }
 
+/*
+ * A buffer is searched a window at a time.  A gap buffer is searched
+ * in one window, after moving the gap out of the way.  A piece table
+ * is searched a piece at a time where the text lies, and only the
+ * text around the boundaries between pieces, which a match could
+ * cross, is copied; a regexp match is only found across a boundary
+ * if it runs no more than SEAM_REACH bytes past its start.
+ */
+#define SEAM_REACH 1024		/* Reach of a regexp across a boundary. */
+#define SEAM_STARTS 4096	/* Most starts in a window of copied text. */
+
+typedef struct
+{
+  size_t lo, hi;		/* Matches starting from `lo' to `hi' - 1 are sought. */
+  size_t base;			/* Buffer offset of the text. */
+  castr text;			/* The text, from before `lo' to past `hi'. */
+} Search_window;
+
+typedef struct
+{
+  Buffer *bp;			/* The buffer searched. */
+  size_t size;			/* Its size. */
+  size_t to;			/* End of the starts sought. */
+  size_t reach;			/* How far a match can run past its start. */
+  size_t next;			/* First start not yet in a window. */
+  BufferSpan span;		/* The pieces not yet reached. */
+  const char *s;		/* The current piece, or NULL. */
+  size_t o, len;		/* Its offset and length. */
+} Search_plan;
+
+/*
+ * Return the end of the text that matches starting before `hi' could
+ * reach.
+ */
+static size_t
+search_plan_end (Search_plan *sp, size_t hi)
+{
+  return sp->reach < sp->size - MIN (sp->size, hi - 1) ? hi - 1 + sp->reach : sp->size;
+}
+
+/*
+ * Plan a search of `bp' for matches starting from `from' to `to' - 1
+ * that run at most `reach' bytes past their start.
+ */
+static Search_plan
+search_plan (Buffer *bp, size_t from, size_t to, size_t reach)
+{
+  Search_plan sp = {.bp = bp, .size = get_buffer_size (bp), .to = to, .reach = reach,
+                    .next = from, .o = from - (from > 0)};
+  if (get_buffer_piece_table (bp))
+    {
+      sp.reach = MIN (reach, SEAM_REACH);
+      sp.span = buffer_span (bp, region_new (sp.o, search_plan_end (&sp, to)));
+    }
+  return sp;
+}
+
+/*
+ * Set `*w' to the next window of a search, in order, and return
+ * true, or return false if there are no more.  The character before
+ * each window's starts is in it, for `\b' and the like.
+ */
+static bool
+search_plan_next (Search_plan *sp, Search_window *w)
+{
+  size_t lo = sp->next, hi = sp->to;
+  if (lo >= hi)
+    return false;
+
+  if (!get_buffer_piece_table (sp->bp))
+    {
+      w->text = get_buffer_text_view (sp->bp, lo - (lo > 0), search_plan_end (sp, hi),
+                                      &w->base);
+      w->lo = lo;
+      w->hi = sp->next = hi;
+      return true;
+    }
+
+  /* Find the next piece holding starts from `lo' with room for
+     their matches, and copy the text before it. */
+  for (;;)
+    {
+      size_t end = sp->o + sp->len;
+      size_t a = MAX (lo, sp->o + (sp->o > 0));
+      size_t b = MIN (hi, end == sp->size ? end + 1 : end + 1 - MIN (end + 1, sp->reach));
+      if (sp->s != NULL && a < b)
+        {
+          if (a == lo)
+            {
+              w->text = castr_new_nstr (sp->s, sp->len);
+              w->base = sp->o;
+              w->lo = lo;
+              w->hi = sp->next = b;
+              return true;
+            }
+          hi = a;
+          break;
+        }
+      if (!buffer_span_next (&sp->span, &sp->s, &sp->len))
+        break;
+      sp->o = end;
+    }
+
+  w->lo = lo;
+  w->hi = sp->next = MIN (hi, lo + SEAM_STARTS);
+  w->base = lo - (lo > 0);
+  w->text = get_buffer_region (sp->bp, region_new (w->base, search_plan_end (sp, w->hi))).as;
+  return true;
+}
+
+/*
+ * Search the window `w' of a buffer of `size' bytes as
+ * find_substr does, for a match starting from `from'.
+ */
+static int
+find_in_window (Search_window *w, size_t size, const char *n, size_t nsize, size_t from,
+                bool forward, bool notbol, bool noteol, bool regex, bool icase)
+{
+  return find_substr (w->text, w->base, n, nsize, from, forward ? w->hi - 1 : w->hi,
+                      forward, notbol, noteol || w->base + astr_len (w->text) < size,
+                      regex, icase);
+}
+
+/*
+ * Search `bp' for a match starting from `from' to `to' - 1, as
+ * find_substr does, setting `*w' to the window it is found in.
+ */
+static int
+find_in_buffer (Buffer *bp, const char *n, size_t nsize, size_t from, size_t to,
+                bool forward, bool notbol, bool noteol, bool regex, bool icase,
+                Search_window *w)
+{
+  Search_plan sp = search_plan (bp, from, to, regex ? SIZE_MAX : nsize);
+  int pos = -1;
+  if (forward)
+    {
+      while (search_plan_next (&sp, w))
+        if ((pos = find_in_window (w, sp.size, n, nsize, w->lo, true, notbol, noteol,
+                                   regex, icase)) >= 0 || re_find_err)
+          break;
+      return pos;
+    }
+
+  /* Backwards, the last window with a match has the last match. */
+  Search_window *ws = NULL;
+  size_t nw = 0, maxw = 0;
+  for (; search_plan_next (&sp, w); ws[nw++] = *w)
+    if (nw == maxw)
+      {
+        maxw = MAX (maxw * 2, 16);
+        ws = xrealloc (ws, maxw * sizeof (Search_window));
+      }
+  while (nw > 0)
+    {
+      *w = ws[--nw];
+      if ((pos = find_in_window (w, sp.size, n, nsize, w->lo, false, notbol, noteol,
+                                 regex, icase)) >= 0 || re_find_err)
+        break;
+    }
+  free (ws);
+  return pos;
+}
+
+/*
+ * Append the text of region `r' of `bp' to `as'.
+ */
+static void
+cat_buffer_text (astr as, Buffer *bp, Region r)
+{
+  BufferSpan span = buffer_span (bp, r);
+  const char *s;
+  size_t len;
+  while (buffer_span_next (&span, &s, &len))
+    astr_cat_nstr (as, s, len);
+}
+
 static bool
 search (size_t o, const char *s, int forward, int regexp)
 {
@@ -100,10 +417,11 @@ search (size_t o, const char *s, int forward, int regexp)
   bool notbol = forward ? o > 0 : false;
   bool noteol = forward ? false : o < get_buffer_size (cur_bp);
   size_t from = forward ? o : 0;
-  size_t to = forward ? get_buffer_size (cur_bp) : o;
-  int pos = find_substr (get_buffer_pre_point (cur_bp), get_buffer_post_point (cur_bp),
-                         s, ssize, from, to, forward, notbol, noteol, regexp,
-                         get_variable_bool ("case-fold-search") && no_upper (s, ssize, regexp));
+  size_t to = forward ? get_buffer_size (cur_bp) + 1 : o;
+  Search_window w;
+  int pos = find_in_buffer (cur_bp, s, ssize, from, to, forward, notbol, noteol, regexp,
+                            get_variable_bool ("case-fold-search")
+                            && no_upper (s, ssize, regexp), &w);
   if (pos < 0)
     return false;
 
@@ -170,24 +488,189 @@ Search backward from point for match for regular expression REGEXP.")
   return do_search (false, true, astr_new_cstr(pattern));
 }
 
+static castr isearch_pattern = NULL;	/* Pattern of the search in progress. */
+static bool isearch_regexp;		/* The pattern is a regexp. */
+
+/*
+ * Matches of the incremental search pattern in the text on screen,
+ * cached by buffer, change tick, range and pattern, so that redisplay
+ * only searches again when one of those changes.
+ */
+#define MATCH_CACHE_SIZE 4
+
+typedef struct
+{
+  Buffer *bp;			/* Buffer searched, or NULL if unused. */
+  size_t tick;			/* Its change tick when searched. */
+  size_t start, end;		/* Range the matches are in. */
+  astr pattern;			/* Pattern searched for. */
+  bool regexp;			/* The pattern is a regexp. */
+  bool icase;			/* Case was ignored. */
+  Region *matches;		/* The matches, in order. */
+  size_t nmatches;		/* Number of matches. */
+  size_t maxmatches;		/* Number of matches allocated. */
+} Match_cache;
+
+static Match_cache match_cache[MATCH_CACHE_SIZE];
+static size_t match_cache_next = 0;
+static struct re_registers match_cache_regs; /* Not those of searches. */
+
+/*
+ * Return the non-empty matches of the incremental search in progress
+ * in `bp' that are in the text between `start' and `end', setting
+ * `*n' to their number.  Only that range is searched, together with
+ * what comes before it that could start a match ending in it: for a
+ * literal, its length less one, and for a regexp, the line before.
+ */
+const Region *
+isearch_matches (Buffer *bp, size_t start, size_t end, size_t *n)
+{
+  *n = 0;
+  if (!get_buffer_isearch (bp) || isearch_pattern == NULL || astr_len (isearch_pattern) == 0)
+    return NULL;
+
+  const char *p = astr_cstr (isearch_pattern);
+  size_t plen = astr_len (isearch_pattern);
+  bool icase = get_variable_bool ("case-fold-search") && no_upper (p, plen, isearch_regexp);
+  for (size_t i = 0; i < MATCH_CACHE_SIZE; i++)
+    {
+      Match_cache *mc = &match_cache[i];
+      if (mc->bp == bp && mc->tick == get_buffer_tick (bp)
+          && mc->start == start && mc->end == end
+          && mc->regexp == isearch_regexp && mc->icase == icase
+          && astr_len (mc->pattern) == plen && memcmp (astr_cstr (mc->pattern), p, plen) == 0)
+        {
+          *n = mc->nmatches;
+          return mc->matches;
+        }
+    }
+
+  Match_cache *mc = &match_cache[match_cache_next++ % MATCH_CACHE_SIZE];
+  mc->bp = bp;
+  mc->tick = get_buffer_tick (bp);
+  mc->start = start;
+  mc->end = end;
+  mc->pattern = astr_cpy (mc->pattern ? mc->pattern : astr_new (), isearch_pattern);
+  mc->regexp = isearch_regexp;
+  mc->icase = icase;
+  mc->nmatches = 0;
+
+  /* Leave any error for isearch to report. */
+  const char *err = re_find_err;
+  size_t from = start;
+  if (!isearch_regexp)
+    from = start - MIN (start, plen - 1);
+  else if (start > 0 && (from = buffer_prev_line (bp, start)) == SIZE_MAX)
+    from = 0;
+  Cached_pattern *cp = NULL;
+  unsigned not_bol = 0, not_eol = 0;
+  if (isearch_regexp)
+    {
+      cp = compile_pattern (p, plen, RE_SYNTAX_EMACS | (icase ? RE_ICASE : 0));
+      if (cp == NULL)
+        end = from;
+      else
+        {
+          not_bol = cp->pattern.not_bol;
+          not_eol = cp->pattern.not_eol;
+        }
+    }
+  Search_plan sp = search_plan (bp, from, end, isearch_regexp ? SIZE_MAX : plen);
+  Search_window w;
+  for (size_t o = from; search_plan_next (&sp, &w);)
+    {
+      const char *s = astr_cstr (w.text);
+      size_t len = astr_len (w.text), base = w.base;
+      if (cp)
+        {
+          cp->pattern.not_bol = base > 0;
+          cp->pattern.not_eol = base + len < sp.size;
+        }
+      for (o = MAX (o, w.lo); o < w.hi;)
+        {
+          size_t ms, me;
+          if (cp)
+            {
+              int pos = re_search (&cp->pattern, s, (int) len, (int) (o - base),
+                                   (int) (w.hi - 1 - o), &match_cache_regs);
+              if (pos < 0)
+                break;
+              ms = pos + base;
+              me = match_cache_regs.end[0] + base;
+            }
+          else
+            {
+              const char *m = mem_find (s + o - base, MIN (len + base, w.hi - 1 + plen) - o,
+                                        p, plen, icase);
+              if (m == NULL)
+                break;
+              ms = m - s + base;
+              me = ms + plen;
+            }
+
+          if (me > ms && me > start)
+            {
+              if (mc->nmatches == mc->maxmatches)
+                {
+                  mc->maxmatches = MAX (mc->maxmatches * 2, 16);
+                  mc->matches = xrealloc (mc->matches, mc->maxmatches * sizeof (Region));
+                }
+              mc->matches[mc->nmatches++] = region_new (ms, me);
+            }
+          o = me > ms ? me : me + 1;
+        }
+    }
+  if (cp)
+    {
+      cp->pattern.not_bol = not_bol;
+      cp->pattern.not_eol = not_eol;
+    }
+  re_find_err = err;
+
+  *n = mc->nmatches;
+  return mc->matches;
+}
+
+/*
+ * One step of an incremental search.  A step is pushed for every
+ * key that changes the pattern or the match, so that rubbing out
+ * returns to the previous match without searching again.
+ */
+typedef struct
+{
+  size_t len;			/* Length of the pattern. */
+  size_t pt;			/* Point after the step. */
+  size_t match;			/* Start of the last match found. */
+  size_t base;			/* Where the search of the pattern began. */
+  bool found;			/* The pattern was found. */
+  int forward;			/* Direction of the search. */
+} Isearch_step;
+
 /*
  * Incremental search engine.
  */
 static SCM
 isearch (int forward, int regexp)
 {
-  Marker *old_mark = copy_marker (get_buffer_mark (get_window_bp (cur_wp)));
+  Marker *old_mark = weak_marker (copy_marker (get_buffer_mark (get_window_bp (cur_wp))));
 
   set_buffer_isearch (get_window_bp (cur_wp), true);
 
-  int last = true;
   astr pattern = astr_new ();
-  size_t start = get_buffer_pt (cur_bp), cur = start;
+  size_t start = get_buffer_pt (cur_bp);
+  size_t nsteps = 1, maxsteps = 16;
+  Isearch_step *steps = xmalloc (maxsteps * sizeof (Isearch_step));
+  steps[0] = (Isearch_step) {.len = 0, .pt = start, .match = start,
+                             .base = start, .found = true, .forward = forward};
+  isearch_pattern = pattern;
+  isearch_regexp = regexp;
   for (;;)
     {
+      Isearch_step *top = &steps[nsteps - 1];
+
       /* Make the minibuf message. */
       astr buf = astr_fmt ("%sI-search%s: %s",
-                           (last ?
+                           (top->found ?
                             (regexp ? "Regexp " : "") :
                             (regexp ? "Failing regexp " : "Failing ")),
                            forward ? "" : " backward",
@@ -210,6 +693,10 @@ isearch (int forward, int regexp)
 
       int c = getkey (GETKEY_DEFAULT);
 
+      /* Where to search from, or SIZE_MAX not to search. */
+      size_t from = SIZE_MAX, base = top->base;
+      bool extended = false;
+
       if (c == KBD_CANCEL)
         {
           goto_offset (start);
@@ -227,21 +714,18 @@ isearch (int forward, int regexp)
         }
       else if (c == KBD_BS)
         {
-          if (astr_len (pattern) > 0)
+          if (nsteps > 1)
             {
-              astr_truncate (pattern, astr_len (pattern) - 1);
-              cur = start;
-              goto_offset (start);
+              /* Go back to the previous step. */
+              top = &steps[--nsteps - 1];
+              astr_truncate (pattern, top->len);
+              forward = top->forward;
+              goto_offset (top->pt);
               thisflag |= FLAG_NEED_RESYNC;
             }
           else
             ding ();
         }
-      else if (c & KBD_CTRL && (c & 0xff) == 'q')
-        {
-          minibuf_write ("%s^Q-", astr_cstr (buf));
-          astr_cat_char (pattern, getkey_unfiltered (GETKEY_DEFAULT));
-        }
       else if (c & KBD_CTRL && ((c & 0xff) == 'r' || (c & 0xff) == 's'))
         {
           /* Invert direction. */
@@ -252,12 +736,23 @@ isearch (int forward, int regexp)
           if (astr_len (pattern) > 0)
             {
               /* Find next match. */
-              cur = get_buffer_pt (cur_bp);
+              from = get_buffer_pt (cur_bp);
               /* Save search string. */
               last_search = astr_cpy (astr_new (), pattern);
             }
           else if (last_search != NULL)
-            astr_cpy (pattern, last_search);
+            {
+              astr_cpy (pattern, last_search);
+              from = get_buffer_pt (cur_bp);
+            }
+          if (from != SIZE_MAX)
+            base = from;
+        }
+      else if (c & KBD_CTRL && (c & 0xff) == 'q')
+        {
+          minibuf_write ("%s^Q-", astr_cstr (buf));
+          astr_cat_char (pattern, getkey_unfiltered (GETKEY_DEFAULT));
+          extended = true;
         }
       else if (c & KBD_META || c & KBD_CTRL || c > KBD_TAB)
         {
@@ -284,12 +779,52 @@ isearch (int forward, int regexp)
           break;
         }
       else
-        astr_cat_char (pattern, c);
+        {
+          astr_cat_char (pattern, c);
+          extended = true;
+        }
 
-      if (astr_len (pattern) > 0)
-        last = search (cur, astr_cstr (pattern), forward, regexp);
-      else
-        last = true;
+      /* A longer literal can only match where the shorter one did or
+         further on, so resume at the current match, which is checked
+         first, and one that has already failed cannot match at all.
+         A longer regexp may match earlier, so search it again from
+         where the search of the pattern began. */
+      if (extended && top->len == 0)
+        from = top->pt;
+      else if (extended && regexp)
+        from = base;
+      else if (extended && top->found)
+        from = forward ? top->match
+          : MIN (top->match + 1, get_buffer_size (cur_bp));
+
+      if (c != KBD_BS)
+        {
+          Isearch_step step = {.len = astr_len (pattern),
+                               .pt = get_buffer_pt (cur_bp),
+                               .match = top->match,
+                               .base = base,
+                               .found = top->found && from == SIZE_MAX,
+                               .forward = forward};
+          if (from != SIZE_MAX)
+            {
+              step.found = search (from, astr_cstr (pattern), forward, regexp);
+              if (step.found)
+                {
+                  step.pt = get_buffer_pt (cur_bp);
+                  step.match = match_start;
+                }
+            }
+
+          if (nsteps == maxsteps)
+            {
+              maxsteps *= 2;
+              steps = xrealloc (steps, maxsteps * sizeof (Isearch_step));
+            }
+          steps[nsteps++] = step;
+
+          /* Redraw the other matches of the new pattern. */
+          thisflag |= FLAG_NEED_RESYNC;
+        }
 
       if (thisflag & FLAG_NEED_RESYNC)
         {
@@ -300,7 +835,9 @@ isearch (int forward, int regexp)
 
   /* done */
   set_buffer_isearch (get_window_bp (cur_wp), false);
+  isearch_pattern = NULL;
 
+  free (steps);
   if (old_mark)
     unchain_marker (old_mark);
 
@@ -353,17 +890,124 @@ is treated as a regexp.  See @kbd{M-x isearch-forward} for more info.")
  * and 0 otherwise.
  */
 static int
-check_case (astr as)
+check_case (const char *s, size_t len)
 {
   size_t i;
-  for (i = 0; i < astr_len (as) && isupper ((int) astr_get (as, i)); i++)
+  for (i = 0; i < len && isupper ((int) s[i]); i++)
     ;
-  if (i == astr_len (as))
+  if (i == len)
     return 2;
   else if (i == 1)
-    for (; i < astr_len (as) && !isupper ((int) astr_get (as, i)); i++)
+    for (; i < len && !isupper ((int) s[i]); i++)
       ;
-  return i == astr_len (as);
+  return i == len;
+}
+
+/*
+ * Append the replacement `repl' for the last match in the text `s'
+ * to `as'.  For a regexp, `\&' stands for the match, `\N' for its
+ * Nth group and `\\' for a backslash.
+ */
+static void
+expand_replacement (astr as, castr repl, const char *s, bool regexp)
+{
+  if (!regexp)
+    {
+      astr_cat (as, repl);
+      return;
+    }
+
+  const char *p = astr_cstr (repl);
+  for (size_t i = 0; i < astr_len (repl); i++)
+    if (p[i] != '\\' || i + 1 == astr_len (repl))
+      astr_cat_char (as, p[i]);
+    else if (p[++i] == '&' || isdigit ((int) p[i]))
+      {
+        size_t g = p[i] == '&' ? 0 : (size_t) (p[i] - '0');
+        if (g < match_regs->num_regs && match_regs->start[g] >= 0)
+          astr_cat_nstr (as, s + match_regs->start[g],
+                         match_regs->end[g] - match_regs->start[g]);
+      }
+    else
+      astr_cat_char (as, p[i]);
+}
+
+/*
+ * Replace every match of `find' after `o' with `repl'.  The matches
+ * are all found in one scan and the new text built in one pass, then
+ * put in the buffer as a single undoable change.  Returns the number
+ * of replacements.
+ */
+static size_t
+replace_all (size_t o, castr find, castr repl, bool regexp)
+{
+  const char *eol = get_buffer_eol (cur_bp);
+  bool find_no_upper = no_upper (astr_cstr (find), astr_len (find), regexp);
+  bool icase = get_variable_bool ("case-fold-search") && find_no_upper;
+  bool recase = find_no_upper && get_variable_bool ("case-replace");
+
+  /* Convert the replacement to the buffer's EOL type once. */
+  repl = estr_cat ((estr) {.as = astr_new (), .eol = eol}, estr_new_astr (repl)).as;
+
+  Region *r = NULL;
+  size_t *lens = NULL, n = 0, maxn = 0, prev = SIZE_MAX;
+  astr text = astr_new (), case_repl = astr_new ();
+  Search_plan sp = search_plan (cur_bp, o, get_buffer_size (cur_bp) + 1,
+                                regexp ? SIZE_MAX : astr_len (find));
+  Search_window w;
+  while (search_plan_next (&sp, &w))
+    {
+      const char *s = astr_cstr (w.text);
+      for (o = MAX (o, w.lo); o < w.hi;)
+        {
+          int end = find_in_window (&w, sp.size, astr_cstr (find), astr_len (find), o,
+                                    true, false, false, regexp, icase);
+          if (end < 0)
+            break;
+          size_t start = match_start;
+          o = (size_t) end > start ? (size_t) end : (size_t) end + 1;
+          if ((size_t) end == start && start == prev)
+            continue;		/* No empty match just after a match. */
+
+          if (n == maxn)
+            {
+              maxn = MAX (maxn * 2, 64);
+              r = xrealloc (r, maxn * sizeof (Region));
+              lens = xrealloc (lens, maxn * sizeof (size_t));
+            }
+          if (n > 0)
+            cat_buffer_text (text, cur_bp, region_new (prev, start));
+
+          size_t before = astr_len (text);
+          int case_type = recase ? check_case (s + start - w.base, end - start) : 0;
+          if (case_type != 0)
+            {
+              expand_replacement (astr_truncate (case_repl, 0), repl, s, regexp);
+              astr_cat (text, astr_recase (case_repl, case_type == 1 ?
+                                           case_capitalized : case_upper));
+            }
+          else
+            expand_replacement (text, repl, s, regexp);
+
+          r[n] = region_new (start, end);
+          lens[n++] = astr_len (text) - before;
+          prev = end;
+        }
+      if (re_find_err)
+        break;
+    }
+
+  if (n > 0)
+    {
+      if (replace_regions (r, lens, n, (estr) {.as = text, .eol = eol}))
+        goto_offset (get_buffer_pt (cur_bp));
+      else
+        n = 0;
+      thisflag |= FLAG_NEED_RESYNC;
+    }
+  free (r);
+  free (lens);
+  return n;
 }
 
 SCM_DEFINE (G_query_replace, "query-replace", 0, 0, 0, (void), "\
@@ -383,43 +1027,42 @@ what to do with it.")
   if (repl == NULL)
     return G_keyboard_quit ();
 
-  bool noask = false;
   size_t count = 0;
   while (search (get_buffer_pt (cur_bp), astr_cstr (find), true, false))
     {
       int c = ' ';
 
-      if (!noask)
+      if (thisflag & FLAG_NEED_RESYNC)
+        window_resync (cur_wp);
+      for (;;)
         {
-          if (thisflag & FLAG_NEED_RESYNC)
-            window_resync (cur_wp);
-          for (;;)
-            {
-              minibuf_write
-                ("Query replacing `%s' with `%s' (y, n, !, ., q)? ", astr_cstr (find),
-                 astr_cstr (repl));
-              c = getkey (GETKEY_DEFAULT);
-              if (c == KBD_CANCEL || c == KBD_RET || c == ' ' || c == 'y'
-                  || c == 'n' || c == 'q' || c == '.' || c == '!')
-                break;
-              /* FIXME: Remove this prompt (see Lua Zile) */
-              minibuf_error ("Please answer y, n, !, . or q.");
-              waitkey ();
-            }
-          minibuf_clear ();
-
-          if (c == 'q')			/* Quit immediately. */
+          minibuf_write
+            ("Query replacing `%s' with `%s' (y, n, !, ., q)? ", astr_cstr (find),
+             astr_cstr (repl));
+          c = getkey (GETKEY_DEFAULT);
+          if (c == KBD_CANCEL || c == KBD_RET || c == ' ' || c == 'y'
+              || c == 'n' || c == 'q' || c == '.' || c == '!')
             break;
-          else if (c == KBD_CANCEL)	/* C-g */
-            {
-	      ok = G_keyboard_quit ();
-             break;
-            }
-          else if (c == '!')		/* Replace all without asking. */
-            noask = true;
-          else if (c == 'n' || c == KBD_RET || c == KBD_DEL) /* Do not replace. */
-            continue;
+          /* FIXME: Remove this prompt (see Lua Zile) */
+          minibuf_error ("Please answer y, n, !, . or q.");
+          waitkey ();
         }
+      minibuf_clear ();
+
+      if (c == 'q')			/* Quit immediately. */
+        break;
+      else if (c == KBD_CANCEL)	/* C-g */
+        {
+          ok = G_keyboard_quit ();
+          break;
+        }
+      else if (c == '!')		/* Replace all without asking. */
+        {
+          count += replace_all (match_start, find, repl, false);
+          break;
+        }
+      else if (c == 'n' || c == KBD_RET || c == KBD_DEL) /* Do not replace. */
+        continue;
 
       /* Perform replacement. */
       ++count;
@@ -427,14 +1070,15 @@ what to do with it.")
       Region r = region_new (get_buffer_pt (cur_bp) - astr_len (find), get_buffer_pt (cur_bp));
       if (find_no_upper && get_variable_bool ("case-replace"))
         {
-          int case_type = check_case (get_buffer_region (cur_bp, r).as);
+          castr match = get_buffer_region (cur_bp, r).as;
+          int case_type = check_case (astr_cstr (match), astr_len (match));
 
           if (case_type != 0)
             case_repl = astr_recase (astr_cpy (astr_new (), repl),
                                      case_type == 1 ? case_capitalized : case_upper);
         }
 
-      Marker *m = point_marker ();
+      Marker *m = weak_marker (point_marker ());
       goto_offset (r.start);
       replace_estr (astr_len (find), estr_new_astr (case_repl));
       goto_offset (get_marker_o (m));
@@ -452,6 +1096,520 @@ what to do with it.")
   return scm_from_bool (ok);
 }
 
+static SCM
+do_replace (bool regexp, SCM gfind, SCM grepl)
+{
+  const char *name = regexp ? "replace-regexp" : "replace-string";
+  castr find, repl;
+
+  if (!interactive && (SCM_UNBNDP (gfind) || SCM_UNBNDP (grepl)))
+    {
+      guile_wrong_number_of_arguments_error (name);
+      return SCM_UNSPECIFIED;
+    }
+
+  if (SCM_UNBNDP (gfind))
+    find = minibuf_read ("Replace %s: ", "", regexp ? "regexp" : "string");
+  else
+    find = astr_new_cstr (guile_to_locale_string_safe (gfind));
+  if (find == NULL)
+    return G_keyboard_quit ();
+  if (astr_len (find) == 0)
+    return SCM_BOOL_F;
+
+  if (SCM_UNBNDP (grepl))
+    repl = minibuf_read ("Replace %s `%s' with: ", "",
+                         regexp ? "regexp" : "string", astr_cstr (find));
+  else
+    repl = astr_new_cstr (guile_to_locale_string_safe (grepl));
+  if (repl == NULL)
+    return G_keyboard_quit ();
+
+  if (warn_if_readonly_buffer ())
+    return SCM_BOOL_F;
+
+  size_t count = replace_all (get_buffer_pt (cur_bp), find, repl, regexp);
+  if (re_find_err)
+    {
+      minibuf_error ("Invalid regexp: %s", re_find_err);
+      re_find_err = NULL;
+      return SCM_BOOL_F;
+    }
+
+  if (thisflag & FLAG_NEED_RESYNC)
+    window_resync (cur_wp);
+  minibuf_write ("Replaced %zu occurrences", count);
+  return SCM_BOOL_T;
+}
+
+SCM_DEFINE (G_replace_string, "replace-string", 0, 2, 0,
+	    (SCM gfind, SCM grepl), "\
+Replace occurrences of FROM-STRING with TO-STRING.\n\
+Every match from point to the end of the buffer is replaced\n\
+as a single change.")
+{
+  return do_replace (false, gfind, grepl);
+}
+
+SCM_DEFINE (G_replace_regexp, "replace-regexp", 0, 2, 0,
+	    (SCM gfind, SCM grepl), "\
+Replace things after point matching REGEXP with TO-STRING.\n\
+In TO-STRING, `\\&' stands for the whole match, `\\N' for the\n\
+Nth parenthesized group and `\\\\' for a backslash.")
+{
+  return do_replace (true, gfind, grepl);
+}
+
+/*
+ * Occur lists the lines of one or more buffers that match a pattern.
+ * The text is cut into jobs at line boundaries and the jobs shared
+ * out among a pool of threads.  The threads only read the buffer
+ * text, which cannot change until they have all finished.
+ */
+#define OCCUR_CHUNK (1 << 20)	/* Bytes of text in each job. */
+
+typedef struct
+{
+  size_t line;			/* Line number within the job. */
+  size_t o;			/* Offset of the line. */
+  size_t len;			/* Length of the line. */
+  size_t col;			/* Offset of the match in the line. */
+} Occur_hit;
+
+typedef struct
+{
+  size_t buf;			/* Index of the buffer searched. */
+  const char *s;		/* Text of the buffer, from a line start. */
+  size_t len;			/* Length of the text. */
+  const char *eol;		/* EOL type of the text. */
+  size_t start, end;		/* The part of the text to search. */
+  Occur_hit *hits;		/* The lines that match. */
+  size_t nhits;			/* Number of lines that match. */
+  size_t lines;			/* Number of EOLs in the part searched. */
+} Occur_job;
+
+typedef struct
+{
+  castr find;			/* Pattern to search for. */
+  bool regexp;			/* The pattern is a regexp. */
+  bool icase;			/* Ignore case. */
+  Occur_job *jobs;		/* The jobs. */
+  size_t njobs;			/* Number of jobs. */
+  size_t next;			/* Next job to be taken. */
+  pthread_mutex_t lock;		/* Lock for `next'. */
+} Occur_pool;
+
+typedef struct
+{
+  Occur_pool *pool;		/* The pool the thread works for. */
+  struct re_pattern_buffer pattern; /* The thread's copy of the regexp. */
+  pthread_t thread;		/* The thread. */
+  bool started;			/* The thread was started. */
+} Occur_worker;
+
+static size_t
+count_eols (const char *s, size_t n, const char *eol)
+{
+  size_t eol_len = strlen (eol), count = 0;
+  if (eol_len == 1)
+    return mem_count (s, n, eol[0]);
+  for (const char *p; (p = memmem (s, n, eol, eol_len)) != NULL; count++)
+    {
+      n -= p + eol_len - s;
+      s = p + eol_len;
+    }
+  return count;
+}
+
+/*
+ * Record each line of `job' that contains a match.
+ */
+static void
+occur_scan (Occur_job *job, Occur_pool *pool, struct re_pattern_buffer *pattern)
+{
+  const char *s = job->s, *n = astr_cstr (pool->find);
+  size_t nsize = astr_len (pool->find), eol_len = strlen (job->eol);
+  size_t o = job->start, counted = job->start, line = 0, maxhits = 0;
+  while (o < job->end)
+    {
+      /* Find the next match starting in the job. */
+      size_t pos;
+      if (pool->regexp)
+        {
+          int ret = re_search (pattern, s, (int) job->len, (int) o,
+                               (int) (job->end - 1 - o), NULL);
+          if (ret < 0)
+            break;
+          pos = ret;
+        }
+      else
+        {
+          const char *p = mem_find (s + o, MIN (job->len, job->end - 1 + nsize) - o,
+                                    n, nsize, pool->icase);
+          if (p == NULL)
+            break;
+          pos = p - s;
+        }
+
+      /* Find its line, and count the lines before it. */
+      const char *prev = memrmem (s + counted, pos - counted, job->eol, eol_len);
+      size_t ls = prev ? (size_t) (prev - s) + eol_len : counted;
+      line += count_eols (s + counted, ls - counted, job->eol);
+      counted = ls;
+      const char *next = memmem (s + pos, job->len - pos, job->eol, eol_len);
+      size_t le = next ? (size_t) (next - s) : job->len;
+
+      if (job->nhits == maxhits)
+        {
+          maxhits = MAX (maxhits * 2, 64);
+          job->hits = xrealloc (job->hits, maxhits * sizeof (Occur_hit));
+        }
+      job->hits[job->nhits++] = (Occur_hit) {.line = line, .o = ls, .len = le - ls,
+                                             .col = pos - ls};
+      o = le + eol_len;
+    }
+  job->lines = line + count_eols (s + counted, job->end - counted, job->eol);
+}
+
+static void *
+occur_worker (void *arg)
+{
+  Occur_worker *w = arg;
+  Occur_pool *pool = w->pool;
+  for (;;)
+    {
+      pthread_mutex_lock (&pool->lock);
+      size_t i = pool->next++;
+      pthread_mutex_unlock (&pool->lock);
+      if (i >= pool->njobs)
+        break;
+      occur_scan (&pool->jobs[i], pool, &w->pattern);
+    }
+  return NULL;
+}
+
+/*
+ * Search the jobs of `pool' using as many threads as there are
+ * processors, the calling thread being one of them.  Returns false
+ * if the regexp does not compile.
+ */
+static bool
+occur_run (Occur_pool *pool)
+{
+#if defined REDIRECT_MALLOC && !defined HAVE_GC_THREADS
+  /* The collector cannot cope with threads it was not built for. */
+  long ncpu = 1;
+#else
+  long ncpu = sysconf (_SC_NPROCESSORS_ONLN);
+#endif
+  size_t nworkers = MAX (1, MIN (ncpu > 0 ? (size_t) ncpu : 1, pool->njobs));
+  Occur_worker *workers = (Occur_worker *) xzalloc (nworkers * sizeof (Occur_worker));
+  bool ok = true;
+
+  /* Give each thread its own copy of the regexp, as a compiled
+     pattern cannot be used by two searches at once. */
+  reg_syntax_t syntax = RE_SYNTAX_EMACS | (pool->icase ? RE_ICASE : 0);
+  re_set_syntax (syntax);
+  for (size_t i = 0; i < nworkers && ok; i++)
+    {
+      workers[i].pool = pool;
+      if (pool->regexp)
+        {
+          workers[i].pattern.fastmap = (char *) xmalloc (1 << CHAR_BIT);
+          re_find_err = re_compile_pattern (astr_cstr (pool->find),
+                                            (int) astr_len (pool->find),
+                                            &workers[i].pattern);
+          ok = re_find_err == NULL;
+        }
+    }
+
+  if (ok)
+    {
+      mem_scan_init ();
+      pool->next = 0;
+      pthread_mutex_init (&pool->lock, NULL);
+      for (size_t i = 1; i < nworkers; i++)
+        workers[i].started = pthread_create (&workers[i].thread, NULL,
+                                             occur_worker, &workers[i]) == 0;
+      occur_worker (&workers[0]);
+      for (size_t i = 1; i < nworkers; i++)
+        if (workers[i].started)
+          pthread_join (workers[i].thread, NULL);
+      pthread_mutex_destroy (&pool->lock);
+    }
+
+  if (pool->regexp)
+    for (size_t i = 0; i < nworkers; i++)
+      regfree (&workers[i].pattern);
+  free (workers);
+  return ok;
+}
+
+/*
+ * An entry in the *Occur* buffer.
+ */
+typedef struct
+{
+  size_t occur_line;		/* Line of the *Occur* buffer. */
+  astr name;			/* Name of the buffer it refers to. */
+  size_t line;			/* Line of the match in that buffer. */
+  size_t col;			/* Offset of the match in that line. */
+} Occurrence;
+
+static Occurrence *occurrences = NULL;
+static size_t noccurrences = 0;
+
+static void
+write_occur (va_list ap)
+{
+  astr text = va_arg (ap, astr);
+  insert_estr ((estr) {.as = text, .eol = coding_eol_lf});
+}
+
+/*
+ * Cut the `len' bytes of text `s' of buffer number `buf', which are
+ * whole lines, into jobs of `pool'.
+ */
+static void
+occur_add_jobs (Occur_pool *pool, size_t *maxjobs, size_t buf, const char *s, size_t len,
+                const char *eol)
+{
+  for (size_t start = 0, end; start < len; start = end)
+    {
+      end = len;
+      if (len - start > OCCUR_CHUNK)
+        {
+          const char *next = memmem (s + start + OCCUR_CHUNK, len - start - OCCUR_CHUNK,
+                                     eol, strlen (eol));
+          if (next)
+            end = next - s + strlen (eol);
+        }
+      if (pool->njobs == *maxjobs)
+        {
+          *maxjobs = MAX (*maxjobs * 2, 16);
+          pool->jobs = xrealloc (pool->jobs, *maxjobs * sizeof (Occur_job));
+        }
+      pool->jobs[pool->njobs++] = (Occur_job) {.buf = buf, .s = s, .len = len, .eol = eol,
+                                               .start = start, .end = end};
+    }
+}
+
+/*
+ * Cut the text of buffer number `buf', `bp', which is held in a piece
+ * table, into jobs of `pool'.  The lines within a piece are searched
+ * where they lie; only a line that runs from one piece into another
+ * is copied.
+ */
+static void
+occur_add_piece_jobs (Occur_pool *pool, size_t *maxjobs, size_t buf, Buffer *bp)
+{
+  const char *eol = get_buffer_eol (bp), *s;
+  size_t eol_len = strlen (eol), size = get_buffer_size (bp), len, o = 0, end = 0;
+  BufferSpan span = buffer_span (bp, region_new (0, size));
+  while (buffer_span_next (&span, &s, &len))
+    {
+      size_t start = end;
+      end += len;
+      if (o < start)
+        { /* Finish the line running into the piece. */
+          const char *next = memmem (s, len, eol, eol_len);
+          if (next == NULL && end < size)
+            continue;
+          size_t le = next ? (size_t) (next - s) + start + eol_len : end;
+          astr line = get_buffer_region (bp, region_new (o, le)).as;
+          occur_add_jobs (pool, maxjobs, buf, astr_cstr (line), astr_len (line), eol);
+          o = le;
+        }
+      const char *last = memrmem (s + (o - start), end - o, eol, eol_len);
+      size_t le = end == size ? end : last ? (size_t) (last - s) + start + eol_len : o;
+      occur_add_jobs (pool, maxjobs, buf, s + (o - start), le - o, eol);
+      o = le;
+    }
+}
+
+/*
+ * List the lines of the `n' buffers `bps' that match `find' in the
+ * *Occur* buffer.
+ */
+static SCM
+occur (Buffer **bps, size_t n, castr find, bool regexp)
+{
+  /* A regexp with no special characters is searched for literally. */
+  if (regexp && strpbrk (astr_cstr (find), ".*+?[^$\\") == NULL)
+    regexp = false;
+
+  Occur_pool pool = {.find = find, .regexp = regexp,
+                     .icase = get_variable_bool ("case-fold-search")
+                       && no_upper (astr_cstr (find), astr_len (find), regexp)};
+
+  /* Cut the buffers into jobs at line boundaries. */
+  size_t maxjobs = 0;
+  for (size_t i = 0; i < n; i++)
+    if (get_buffer_piece_table (bps[i]))
+      occur_add_piece_jobs (&pool, &maxjobs, i, bps[i]);
+    else
+      {
+        size_t base;
+        castr as = get_buffer_text_view (bps[i], 0, get_buffer_size (bps[i]), &base);
+        occur_add_jobs (&pool, &maxjobs, i, astr_cstr (as), astr_len (as),
+                        get_buffer_eol (bps[i]));
+      }
+
+  if (!occur_run (&pool))
+    {
+      minibuf_error ("Invalid regexp: %s", re_find_err);
+      re_find_err = NULL;
+      free (pool.jobs);
+      return SCM_BOOL_F;
+    }
+
+  /* Write the matching lines of each buffer after a heading. */
+  astr text = astr_new ();
+  size_t total = 0, nbufs = 0, occur_line = 0;
+  noccurrences = 0;
+  for (size_t j = 0, i = 0; i < n; i++)
+    {
+      size_t first = j, count = 0, line = 1;
+      for (; j < pool.njobs && pool.jobs[j].buf == i; j++)
+        count += pool.jobs[j].nhits;
+      if (count == 0)
+        continue;
+      total += count;
+      nbufs++;
+
+      astr_cat (text, astr_fmt ("%zu match%s for \"%s\" in buffer: %s\n",
+                                count, count == 1 ? "" : "es", astr_cstr (find),
+                                get_buffer_name (bps[i])));
+      occur_line++;
+      occurrences = xrealloc (occurrences, (noccurrences + count) * sizeof (Occurrence));
+      astr name = astr_new_cstr (get_buffer_name (bps[i]));
+      for (size_t k = first; k < j; line += pool.jobs[k++].lines)
+        for (size_t h = 0; h < pool.jobs[k].nhits; h++)
+          {
+            Occur_hit *hit = &pool.jobs[k].hits[h];
+            astr_cat (text, astr_fmt ("%7zu:", line + hit->line));
+            astr_cat_nstr (text, pool.jobs[k].s + hit->o, hit->len);
+            astr_cat_char (text, '\n');
+            occurrences[noccurrences++] = (Occurrence) {.occur_line = occur_line++,
+                                                        .name = name,
+                                                        .line = line + hit->line - 1,
+                                                        .col = hit->col};
+          }
+    }
+  for (size_t j = 0; j < pool.njobs; j++)
+    free (pool.jobs[j].hits);
+  free (pool.jobs);
+
+  if (total == 0)
+    {
+      minibuf_write ("Searched %zu buffer%s; no matches for `%s'",
+                     n, n == 1 ? "" : "s", astr_cstr (find));
+      return SCM_BOOL_F;
+    }
+
+  write_temp_buffer ("*Occur*", true, write_occur, text);
+  minibuf_write ("Searched %zu buffer%s; %zu match%s found in %zu buffer%s",
+                 n, n == 1 ? "" : "s", total, total == 1 ? "" : "es",
+                 nbufs, nbufs == 1 ? "" : "s");
+  return SCM_BOOL_T;
+}
+
+static castr
+read_occur_pattern (const char *name, SCM gregexp)
+{
+  castr find;
+  if (!SCM_UNBNDP (gregexp))
+    find = astr_new_cstr (guile_to_locale_string_safe (gregexp));
+  else if (interactive)
+    find = minibuf_read ("List lines matching regexp: ", "");
+  else
+    {
+      guile_wrong_number_of_arguments_error (name);
+      return NULL;
+    }
+  if (find == NULL)
+    G_keyboard_quit ();
+  return find != NULL && astr_len (find) > 0 ? find : NULL;
+}
+
+SCM_DEFINE (G_occur, "occur", 0, 1, 0, (SCM gregexp), "\
+Show all lines in the current buffer containing a match for REGEXP.\n\
+The lines are listed in the *Occur* buffer; use\n\
+`occur-mode-goto-occurrence' there to visit one.")
+{
+  castr find = read_occur_pattern ("occur", gregexp);
+  if (find == NULL)
+    return SCM_BOOL_F;
+  Buffer *bp = cur_bp;
+  return occur (&bp, 1, find, true);
+}
+
+SCM_DEFINE (G_multi_occur, "multi-occur", 0, 1, 0, (SCM gregexp), "\
+Show all lines in all buffers containing a match for REGEXP.\n\
+Temporary buffers, such as *Occur* itself, are not searched.")
+{
+  castr find = read_occur_pattern ("multi-occur", gregexp);
+  if (find == NULL)
+    return SCM_BOOL_F;
+
+  size_t n = 0;
+  for (Buffer *bp = head_bp; bp != NULL; bp = get_buffer_next (bp))
+    n++;
+  Buffer **bps = (Buffer **) xmalloc (MAX (n, 1) * sizeof (Buffer *));
+  n = 0;
+  for (Buffer *bp = head_bp; bp != NULL; bp = get_buffer_next (bp))
+    if (!get_buffer_temporary (bp))
+      bps[n++] = bp;
+
+  SCM ok = occur (bps, n, find, true);
+  free (bps);
+  return ok;
+}
+
+SCM_DEFINE (G_occur_mode_goto_occurrence, "occur-mode-goto-occurrence", 0, 0, 0, (void), "\
+Go to the occurrence listed on the current line of the *Occur* buffer.")
+{
+  if (strcmp (get_buffer_name (cur_bp), "*Occur*") != 0)
+    {
+      minibuf_error ("Not in the *Occur* buffer");
+      return SCM_BOOL_F;
+    }
+
+  /* Find the entry for the current line. */
+  size_t line = offset_to_line (cur_bp, get_buffer_pt (cur_bp));
+  size_t lo = 0, hi = noccurrences;
+  while (lo < hi)
+    {
+      size_t mid = lo + (hi - lo) / 2;
+      if (occurrences[mid].occur_line < line)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+  if (lo == noccurrences || occurrences[lo].occur_line != line)
+    {
+      minibuf_error ("No occurrence on this line");
+      return SCM_BOOL_F;
+    }
+
+  Occurrence *oc = &occurrences[lo];
+  Buffer *bp = find_buffer (astr_cstr (oc->name));
+  if (bp == NULL)
+    {
+      minibuf_error ("Buffer `%s' no longer exists", astr_cstr (oc->name));
+      return SCM_BOOL_F;
+    }
+
+  Window *wp = find_window (astr_cstr (oc->name));
+  if (wp)
+    set_current_window (wp);
+  else
+    switch_to_buffer (bp);
+  size_t o = line_to_offset (bp, oc->line);
+  goto_offset (MIN (o + oc->col, buffer_end_of_line (bp, o)));
+  return SCM_BOOL_T;
+}
+
 void
 init_guile_search_procedures (void)
 {
@@ -465,5 +1623,10 @@ init_guile_search_procedures (void)
 		"isearch-forward-regexp",
 		"isearch-backward-regexp",
 		"query-replace",
+		"replace-string",
+		"replace-regexp",
+		"occur",
+		"multi-occur",
+		"occur-mode-goto-occurrence",
 		NULL);
 }
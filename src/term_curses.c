@@ -73,6 +73,7 @@ void
 term_clear (void)
 {
   clear ();
+  term_invalidate ();
 }
 
 void
@@ -25,11 +25,68 @@
 #include <ctype.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "main.h"
 #include <config.h>
 #include "extern.h"
 
+/*
+ * What a screen row was last drawn with.  A row whose bp and status
+ * are both NULL shows nothing known, and is always redrawn.
+ */
+typedef struct
+{
+  Buffer *bp;			/* Buffer whose text the row shows. */
+  size_t o;			/* Start of the line shown, or SIZE_MAX if none. */
+  size_t len;			/* Length of the line. */
+  size_t startcol;		/* First column shown. */
+  size_t ewidth;		/* Width of the window. */
+  size_t tab_width;		/* Tab width used. */
+  size_t r_start, r_end;	/* Highlighted part of the line, relative to o. */
+  astr status;			/* Status line shown, or NULL. */
+} Row;
+
+static Row *rows = NULL;
+static size_t nrows = 0;
+
+/*
+ * Forget what the screen shows, so that the next redisplay draws
+ * every row.
+ */
+void
+term_invalidate (void)
+{
+  if (rows)
+    memset (rows, 0, nrows * sizeof (Row));
+}
+
+/*
+ * Return true if a row drawn as `old' already shows what `new'
+ * describes.  Lines wholly before or after the text changed since the
+ * last redisplay are the same, even if they have moved.
+ */
+static bool
+row_unchanged (const Row *old, const Row *new)
+{
+  if (old->bp == NULL)
+    return false;
+  if (old->o == SIZE_MAX || new->o == SIZE_MAX)
+    return old->o == new->o;
+  if (old->bp != new->bp || old->len != new->len
+      || old->startcol != new->startcol || old->ewidth != new->ewidth
+      || old->tab_width != new->tab_width
+      || old->r_start != new->r_start || old->r_end != new->r_end)
+    return false;
+
+  size_t start = get_buffer_dirty_start (new->bp);
+  size_t end = get_buffer_dirty_end (new->bp);
+  size_t old_end = get_buffer_dirty_old_end (new->bp);
+  if (start == SIZE_MAX || (old->o + old->len <= start && new->o == old->o))
+    return new->o == old->o;
+  return end != SIZE_MAX && old->o >= old_end && new->o + old_end == old->o + end;
+}
+
 static const char *
 make_char_printable (char c, int x, int cur_tab_width)
 {
@@ -43,15 +100,21 @@ make_char_printable (char c, int x, int cur_tab_width)
 
 static void
 draw_line (size_t line, size_t startcol, Window * wp,
-           size_t o, Region r, int highlight, size_t cur_tab_width)
+           size_t o, Region r, int highlight, size_t cur_tab_width,
+           const Region *matches, size_t nmatches)
 {
   term_move (line, 0);
 
   /* Draw body of line. */
-  size_t x, i, line_len = buffer_line_len (get_window_bp (wp), o);
+  size_t x, i, k = 0, line_len = buffer_line_len (get_window_bp (wp), o);
   for (x = 0, i = startcol;; i++)
     {
-      term_attrset (highlight && in_region (o, i, r) ? FONT_REVERSE : FONT_NORMAL);
+      size_t font = highlight && in_region (o, i, r) ? FONT_REVERSE : FONT_NORMAL;
+      while (k < nmatches && matches[k].end <= o + i)
+        k++;
+      if (k < nmatches && matches[k].start <= o + i)
+        font |= FONT_UNDERLINE;
+      term_attrset (font);
       if (i >= line_len || x >= get_window_ewidth (wp))
         break;
       char c = get_buffer_char (get_window_bp (wp), o + i);
@@ -122,15 +185,9 @@ make_screen_pos (Window * wp)
                       (int) ((float) 100.0 * window_o (wp) / get_buffer_size (get_window_bp (wp))));
 }
 
-static void
-draw_status_line (size_t line, Window * wp)
+static astr
+make_status_line (Window * wp)
 {
-  term_attrset (FONT_REVERSE);
-
-  term_move (line, 0);
-  for (size_t i = 0; i < get_window_ewidth (wp); ++i)
-    term_addstr ("-");
-
   const char *eol_type;
   if (get_buffer_eol (cur_bp) == coding_eol_cr)
     eol_type = "(Mac)";
@@ -139,7 +196,6 @@ draw_status_line (size_t line, Window * wp)
   else
     eol_type = ":";
 
-  term_move (line, 0);
   size_t n = offset_to_line (get_window_bp (wp), window_o (wp));
   astr as = astr_fmt ("--%s%2s  %-15s   %s %-9s (Fundamental",
                       eol_type, make_mode_line_flags (wp), get_buffer_name (get_window_bp (wp)),
@@ -154,6 +210,19 @@ draw_status_line (size_t line, Window * wp)
     astr_cat_cstr (as, " Isearch");
 
   astr_cat_char (as, ')');
+  return as;
+}
+
+static void
+draw_status_line (size_t line, Window * wp, castr as)
+{
+  term_attrset (FONT_REVERSE);
+
+  term_move (line, 0);
+  for (size_t i = 0; i < get_window_ewidth (wp); ++i)
+    term_addstr ("-");
+
+  term_move (line, 0);
   term_addstr (astr_cstr (as));
 
   term_attrset (FONT_NORMAL);
@@ -172,35 +241,74 @@ draw_window (size_t topline, Window * wp)
        assert ((o = buffer_prev_line (get_window_bp (wp), o)) != SIZE_MAX), --i)
     ;
 
-  /* Draw the window lines. */
+  /* Find the end of the text on screen, and the search matches in it. */
+  size_t end = o, nmatches;
+  for (i = 0; i < get_window_eheight (wp) && end != SIZE_MAX; i++)
+    end = buffer_next_line (get_window_bp (wp), end);
+  const Region *matches = isearch_matches (get_window_bp (wp), o,
+                                           end == SIZE_MAX ? get_buffer_size (get_window_bp (wp)) : end,
+                                           &nmatches);
+
+  /* Draw the window lines that have changed. */
   size_t cur_tab_width = tab_width (get_window_bp (wp));
   for (i = topline; i < get_window_eheight (wp) + topline; ++i)
     {
-      /* Clear the line. */
-      term_move (i, 0);
-      term_clrtoeol ();
-
-      /* If at the end of the buffer, don't write any text. */
-      if (o == SIZE_MAX)
-        continue;
+      Row row = {.bp = get_window_bp (wp), .o = o,
+                 .startcol = get_window_start_column (wp),
+                 .ewidth = get_window_ewidth (wp), .tab_width = cur_tab_width};
+      if (o != SIZE_MAX)
+        {
+          row.len = buffer_line_len (get_window_bp (wp), o);
+          if (highlight && r.start <= o + row.len && r.end > o)
+            {
+              row.r_start = MAX (r.start, o) - o;
+              row.r_end = MIN (r.end, o + row.len + 1) - o;
+            }
+        }
+      bool unchanged = row_unchanged (&rows[i], &row);
 
-      draw_line (i, get_window_start_column (wp), wp, o, r, highlight, cur_tab_width);
+      /* Rows showing search matches are redrawn every time. */
+      rows[i] = row;
+      if (get_buffer_isearch (get_window_bp (wp)))
+        rows[i].bp = NULL;
 
-      if (get_window_start_column (wp) > 0)
+      if (!unchanged)
         {
+          /* Clear the line. */
           term_move (i, 0);
-          term_addstr("$");
+          term_clrtoeol ();
+
+          /* If at the end of the buffer, don't write any text. */
+          if (o == SIZE_MAX)
+            continue;
+
+          draw_line (i, get_window_start_column (wp), wp, o, r, highlight, cur_tab_width,
+                     matches, nmatches);
+
+          if (get_window_start_column (wp) > 0)
+            {
+              term_move (i, 0);
+              term_addstr("$");
+            }
         }
 
-      o = buffer_next_line (get_window_bp (wp), o);
+      if (o != SIZE_MAX)
+        o = buffer_next_line (get_window_bp (wp), o);
     }
 
   set_window_all_displayed (wp, o >= get_buffer_size (get_window_bp (wp)));
 
   /* Draw the status line only if there is available space after the
-     buffer text space. */
+     buffer text space, and it has changed. */
   if (get_window_fheight (wp) - get_window_eheight (wp) > 0)
-    draw_status_line (topline + get_window_eheight (wp), wp);
+    {
+      size_t line = topline + get_window_eheight (wp);
+      astr as = make_status_line (wp);
+      if (rows[line].status == NULL || rows[line].ewidth != get_window_ewidth (wp)
+          || strcmp (astr_cstr (rows[line].status), astr_cstr (as)) != 0)
+        draw_status_line (line, wp, as);
+      rows[line] = (Row) {.status = as, .ewidth = get_window_ewidth (wp)};
+    }
 }
 
 static size_t col, cur_topline = 0;
@@ -241,6 +349,13 @@ term_redisplay (void)
       lastcol = col;
     }
 
+  /* Start afresh if the screen has changed size. */
+  if (nrows != term_height ())
+    {
+      nrows = term_height ();
+      rows = XCALLOC (nrows, Row);
+    }
+
   /* Draw the windows. */
   cur_topline = 0;
   size_t topline = 0;
@@ -254,6 +369,10 @@ term_redisplay (void)
       topline += get_window_fheight (wp);
     }
 
+  /* The screen now shows every buffer's text as it is. */
+  for (Buffer *bp = head_bp; bp != NULL; bp = get_buffer_next (bp))
+    set_buffer_dirty_start (bp, SIZE_MAX);
+
   term_redraw_cursor ();
 }
 
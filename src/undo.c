@@ -22,6 +22,9 @@
 
 #include <config.h>
 
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
 #include <libguile.h>
 
 #include "main.h"
@@ -37,8 +40,10 @@ struct Undo
   size_t o;        /* Buffer offset of the undo delta. */
   bool unchanged;  /* Flag indicating that reverting this undo leaves
                       the buffer in an unchanged state. */
-  estr text;       /* Old text. */
+  estr text;       /* Old text; .as is NULL if it was spilled. */
   size_t size;     /* Size of replacement text. */
+  off_t spill_o;   /* Offset of spilled text in the spill file. */
+  size_t spill_len; /* Length of spilled text. */
 };
 
 /* Undo delta types. */
@@ -49,6 +54,247 @@ enum
   UNDO_END_SEQUENCE		/* End a multi operation sequence. */
 };
 
+/*
+ * Undo deltas are allocated from chunks, which are only ever
+ * appended to.
+ */
+#define UNDO_CHUNK_SIZE 256
+static Undo *undo_chunk = NULL;
+static size_t undo_chunk_used = UNDO_CHUNK_SIZE;
+
+static Undo *
+undo_alloc (void)
+{
+  if (undo_chunk_used == UNDO_CHUNK_SIZE)
+    {
+      undo_chunk = (Undo *) XCALLOC (UNDO_CHUNK_SIZE, Undo);
+      undo_chunk_used = 0;
+    }
+  return &undo_chunk[undo_chunk_used++];
+}
+
+/* Maximum number of single-char edits coalesced into one delta,
+   outside an undo sequence. */
+#define MAX_COALESCE 20
+
+static Undo *coalescable = NULL; /* Delta that may be extended. */
+static astr coalesced_before = NULL; /* Chars it has gained in front, reversed. */
+static int sequence_depth = 0;   /* Depth of nested undo sequences. */
+static bool reverting = false;   /* An undo is in progress. */
+
+/*
+ * Return the number of bytes of memory used by a delta.
+ */
+static size_t
+undo_delta_size (const Undo *up)
+{
+  size_t n = up == coalescable && coalesced_before ? astr_len (coalesced_before) : 0;
+  return sizeof (Undo) + (up->type == UNDO_REPLACE_BLOCK && up->text.as ? astr_len (up->text.as) + n : 0);
+}
+
+/*
+ * Old text bigger than `undo-spill-threshold' is written to an
+ * unlinked temporary file instead of being kept in memory.  The space
+ * of deltas that are discarded is kept in a list of holes, sorted by
+ * offset, and reused; a hole at the end of the file is cut off it.
+ */
+static int spill_fd = -1;
+static off_t spill_end = 0;
+
+typedef struct
+{
+  off_t o;			/* Offset of the hole. */
+  size_t len;			/* Its length. */
+} Spill_hole;
+
+static Spill_hole *spill_holes = NULL;
+static size_t spill_nholes = 0, spill_maxholes = 0;
+
+/*
+ * Return the offset of `len' free bytes in the spill file, taking
+ * them from the first hole big enough, or else from the end.
+ */
+static off_t
+spill_alloc (size_t len)
+{
+  for (size_t i = 0; i < spill_nholes; i++)
+    if (spill_holes[i].len >= len)
+      {
+        off_t o = spill_holes[i].o;
+        spill_holes[i].o += len;
+        spill_holes[i].len -= len;
+        if (spill_holes[i].len == 0)
+          memmove (&spill_holes[i], &spill_holes[i + 1],
+                   (--spill_nholes - i) * sizeof (Spill_hole));
+        return o;
+      }
+  spill_end += len;
+  return spill_end - len;
+}
+
+/*
+ * Give back `len' bytes at `o' in the spill file, merging them with
+ * the holes next to them.
+ */
+static void
+spill_free (off_t o, size_t len)
+{
+  size_t i = 0;
+  while (i < spill_nholes && spill_holes[i].o < o)
+    i++;
+  if (i > 0 && spill_holes[i - 1].o + (off_t) spill_holes[i - 1].len == o)
+    spill_holes[--i].len += len;
+  else
+    {
+      if (spill_nholes == spill_maxholes)
+        {
+          spill_maxholes = MAX (spill_maxholes * 2, 16);
+          spill_holes = xrealloc (spill_holes, spill_maxholes * sizeof (Spill_hole));
+        }
+      memmove (&spill_holes[i + 1], &spill_holes[i], (spill_nholes++ - i) * sizeof (Spill_hole));
+      spill_holes[i] = (Spill_hole) {.o = o, .len = len};
+    }
+  if (i + 1 < spill_nholes && spill_holes[i].o + (off_t) spill_holes[i].len == spill_holes[i + 1].o)
+    {
+      spill_holes[i].len += spill_holes[i + 1].len;
+      memmove (&spill_holes[i + 1], &spill_holes[i + 2],
+               (--spill_nholes - (i + 1)) * sizeof (Spill_hole));
+    }
+
+  /* Cut a hole at the end off the file. */
+  if (spill_holes[i].o + (off_t) spill_holes[i].len == spill_end
+      && ftruncate (spill_fd, spill_holes[i].o) == 0)
+    {
+      spill_end = spill_holes[i].o;
+      spill_nholes--;
+    }
+}
+
+/*
+ * Write region `r' of the current buffer to the spill file, and
+ * return true if it was done.
+ */
+static bool
+spill_region (Undo *up, Region r)
+{
+  if (spill_fd < 0)
+    {
+      const char *tmpdir = getenv ("TMPDIR");
+      astr name = astr_fmt ("%s/zileXXXXXX", tmpdir && *tmpdir ? tmpdir : "/tmp");
+      spill_fd = mkstemp ((char *) astr_cstr (name));
+      if (spill_fd < 0)
+        return false;
+      unlink (astr_cstr (name));
+      /* Don't leak it into shell commands. */
+      fcntl (spill_fd, F_SETFD, FD_CLOEXEC);
+    }
+
+  size_t size = get_region_size (r);
+  off_t start = spill_alloc (size), pos = start;
+  BufferSpan span = buffer_span (cur_bp, r);
+  const char *s;
+  size_t len;
+  while (buffer_span_next (&span, &s, &len))
+    for (size_t done = 0; done < len;)
+      {
+        ssize_t n = pwrite (spill_fd, s + done, len - done, pos);
+        if (n <= 0)
+          {
+            spill_free (start, size);
+            return false;
+          }
+        done += n;
+        pos += n;
+      }
+
+  up->text = (estr) {.as = NULL, .eol = get_buffer_eol (cur_bp)};
+  up->spill_o = start;
+  up->spill_len = size;
+  return true;
+}
+
+/*
+ * Return the old text of a delta, reading it back if it was spilled,
+ * or an estr with a NULL .as on error.
+ */
+static estr
+undo_text (const Undo *up)
+{
+  if (up->text.as != NULL)
+    return up->text;
+  return (estr) {.as = astr_cat_fd (astr_new (), spill_fd, up->spill_o, up->spill_len),
+                 .eol = up->text.eol};
+}
+
+static void
+add_undo_size (size_t n)
+{
+  set_buffer_undo_size (cur_bp, get_buffer_undo_size (cur_bp) + n);
+}
+
+/*
+ * Stop extending `coalescable', putting the chars it gained in front
+ * in place.
+ */
+static void
+undo_close_coalesce (void)
+{
+  size_t n = coalesced_before ? astr_len (coalesced_before) : 0;
+  if (n > 0)
+    {
+      astr as = astr_reserve (astr_new (), n + astr_len (coalescable->text.as));
+      while (n-- > 0)
+        astr_cat_char (as, astr_get (coalesced_before, n));
+      coalescable->text.as = astr_cat (as, coalescable->text.as);
+      astr_truncate (coalesced_before, 0);
+    }
+  coalescable = NULL;
+}
+
+/*
+ * Try to extend the last delta with an adjacent single-char insertion
+ * or deletion, and return true if it was done.  A deleted EOL char is
+ * never merged, so the delta's cached line count stays right; the
+ * chars an insertion adds are not known yet, and need not be, as the
+ * delta's old text stays empty.  Chars deleted backwards are kept
+ * aside until the delta is closed, as prepending each would copy the
+ * whole text.
+ */
+static bool
+undo_coalesce (size_t o, size_t osize, size_t size)
+{
+  Undo *up = get_buffer_last_undop (cur_bp);
+  if (up == NULL || up != coalescable || up->unchanged || !get_buffer_modified (cur_bp))
+    return false;
+
+  size_t len = astr_len (up->text.as) + (coalesced_before ? astr_len (coalesced_before) : 0);
+  if (sequence_depth == 0 && MAX (up->size, len) >= MAX_COALESCE)
+    return false;
+
+  if (osize == 0 && size == 1 && len == 0 && o == up->o + up->size)
+    {
+      up->size++;
+      return true;
+    }
+
+  if (osize != 1 || size != 0 || up->size != 0 || (o != up->o && o + 1 != up->o))
+    return false;
+  char c = get_buffer_char (cur_bp, o);
+  if (c == '\n' || c == '\r')
+    return false;
+  if (o == up->o)
+    astr_cat_char (up->text.as, c);
+  else
+    {
+      if (coalesced_before == NULL)
+        coalesced_before = astr_new ();
+      astr_cat_char (coalesced_before, c);
+      up->o = o;
+    }
+  add_undo_size (1);
+  return true;
+}
+
 /*
  * Save a reverse delta for doing undo.
  */
@@ -58,7 +304,11 @@ undo_save (int type, size_t o, size_t osize, size_t size)
   if (get_buffer_noundo (cur_bp))
     return;
 
-  Undo * up = (Undo *) XZALLOC (Undo);
+  if (type == UNDO_REPLACE_BLOCK && osize + size == 1 && undo_coalesce (o, osize, size))
+    return;
+
+  undo_close_coalesce ();
+  Undo * up = undo_alloc ();
   *up = (Undo) {
     .next = get_buffer_last_undop (cur_bp),
     .type = type,
@@ -69,22 +319,38 @@ undo_save (int type, size_t o, size_t osize, size_t size)
   if (type == UNDO_REPLACE_BLOCK)
     {
       up->size = size;
-      up->text = get_buffer_region (cur_bp, region_new (o, o + osize));
+      long threshold = get_variable_number ("undo-spill-threshold");
+      if (osize == 0)
+        up->text = estr_empty;
+      else if (threshold <= 0 || osize <= (size_t) threshold
+               || !spill_region (up, region_new (o, o + osize)))
+        up->text = get_buffer_region (cur_bp, region_new (o, o + osize));
       up->unchanged = !get_buffer_modified (cur_bp);
     }
 
   set_buffer_last_undop (cur_bp, up);
+  add_undo_size (undo_delta_size (up));
+  coalescable = type == UNDO_REPLACE_BLOCK && osize + size == 1 ? up : NULL;
+
+  /* Don't wait for the command to finish, which a script never does,
+     once the strong limit is passed. */
+  if (!reverting && sequence_depth == 0
+      && get_buffer_undo_size (cur_bp) > (size_t) MAX (get_variable_number ("undo-strong-limit"), 0))
+    undo_trim (cur_bp);
 }
 
 void
 undo_start_sequence (void)
 {
   undo_save (UNDO_START_SEQUENCE, get_buffer_pt (cur_bp), 0, 0);
+  sequence_depth++;
 }
 
 void
 undo_end_sequence (void)
 {
+  if (sequence_depth > 0)
+    sequence_depth--;
   undo_save (UNDO_END_SEQUENCE, 0, 0, 0);
 }
 
@@ -95,28 +361,222 @@ undo_save_block (size_t o, size_t osize, size_t size)
 }
 
 /*
- * Revert an action.  Return the next undo entry.
+ * Clear the deltas of `bp' from `up' on, which have been cut off its
+ * list, so the chunks holding them do not keep their text alive.
+ * Their space in the spill file is given back for reuse.
+ */
+static void
+undo_clear (Buffer *bp, Undo *up)
+{
+  for (Undo *next; up != NULL; up = next)
+    {
+      next = up->next;
+      if (up == get_buffer_next_undop (bp))
+        set_buffer_next_undop (bp, NULL);
+      if (up == coalescable)
+        {
+          coalescable = NULL;
+          if (coalesced_before)
+            astr_truncate (coalesced_before, 0);
+        }
+      if (up->type == UNDO_REPLACE_BLOCK && up->text.as == NULL)
+        spill_free (up->spill_o, up->spill_len);
+      *up = (Undo) {.type = UNDO_START_SEQUENCE};
+    }
+}
+
+/*
+ * Free all the undo deltas of `bp'.
+ */
+void
+undo_free (Buffer *bp)
+{
+  Undo *up = get_buffer_last_undop (bp);
+  set_buffer_last_undop (bp, NULL);
+  set_buffer_next_undop (bp, NULL);
+  undo_clear (bp, up);
+  set_buffer_undo_size (bp, 0);
+}
+
+/*
+ * Discard the oldest deltas of `bp' once they use more than
+ * `undo-limit' bytes, keeping whole sequences.  The most recent
+ * change is kept unless it alone uses more than `undo-strong-limit'.
+ */
+void
+undo_trim (Buffer *bp)
+{
+  size_t limit = (size_t) MAX (get_variable_number ("undo-limit"), 0);
+  if (sequence_depth > 0 || get_buffer_undo_size (bp) <= limit)
+    return;
+  size_t strong_limit = (size_t) MAX (get_variable_number ("undo-strong-limit"), 0);
+
+  /* Find the oldest delta to keep. */
+  Undo *keep = NULL, *up;
+  size_t size = 0, kept = 0;
+  int depth = 0;
+  for (up = get_buffer_last_undop (bp); up != NULL; up = up->next)
+    {
+      size += undo_delta_size (up);
+      if (up->type == UNDO_END_SEQUENCE)
+        depth++;
+      else if (up->type == UNDO_START_SEQUENCE)
+        depth--;
+      if (depth <= 0)
+        {
+          depth = 0;
+          if (size > (keep ? limit : strong_limit))
+            break;
+          keep = up;
+          kept = size;
+        }
+    }
+  if (up == NULL)
+    return;
+
+  /* Cut off the rest. */
+  if (keep)
+    {
+      up = keep->next;
+      keep->next = NULL;
+    }
+  else
+    {
+      up = get_buffer_last_undop (bp);
+      set_buffer_last_undop (bp, NULL);
+    }
+  undo_clear (bp, up);
+  set_buffer_undo_size (bp, kept);
+}
+
+/*
+ * A run of adjacent deltas, reverted as a single replacement.
+ */
+typedef struct
+{
+  size_t o;          /* Start of the replacement. */
+  size_t del;        /* Number of chars to replace. */
+  astr before;       /* Replacement text added in front, reversed. */
+  estr text;         /* The rest; .as is NULL if the run is empty. */
+  size_t pt;         /* Point after reverting the last delta. */
+  bool unchanged;    /* The last delta's `unchanged' flag. */
+} Undo_run;
+
+/*
+ * Add delta `up' to `run' if it is adjacent, and return true if it
+ * was added.
+ */
+static bool
+run_add (Undo_run *run, const Undo *up, estr old)
+{
+  estr text = (estr) {.as = astr_new (), .eol = get_buffer_eol (cur_bp), .lines = 1};
+  if (run->text.as == NULL)
+    {
+      run->o = up->o;
+      run->del = up->size;
+      run->before = astr_new ();
+      run->text = estr_cat (text, old);
+    }
+  else if (up->o == run->o + astr_len (run->before) + astr_len (run->text.as))
+    {
+      run->del += up->size;
+      run->text = estr_cat (run->text, old);
+    }
+  else if (up->o + up->size == run->o)
+    {
+      /* Prepending would copy the whole run each time, so keep the
+         text in front reversed, and put it right in run_flush. */
+      castr as = estr_cat (text, old).as;
+      run->o = up->o;
+      run->del += up->size;
+      for (size_t i = astr_len (as); i-- > 0;)
+        astr_cat_char (run->before, astr_get (as, i));
+    }
+  else
+    return false;
+
+  run->pt = up->o + estr_len (old, get_buffer_eol (cur_bp));
+  run->unchanged = up->unchanged;
+  return true;
+}
+
+static void
+run_flush (Undo_run *run)
+{
+  if (run->text.as == NULL)
+    return;
+  estr text = run->text;
+  size_t n = astr_len (run->before);
+  if (n > 0)
+    {
+      astr as = astr_reserve (astr_new (), n + astr_len (text.as));
+      while (n-- > 0)
+        astr_cat_char (as, astr_get (run->before, n));
+      text = estr_cat ((estr) {.as = as, .eol = text.eol}, text);
+    }
+  goto_offset (run->o);
+  replace_estr (run->del, text);
+  goto_offset (run->pt);
+  if (run->unchanged)
+    set_buffer_modified (cur_bp, false);
+  run->text.as = NULL;
+}
+
+/*
+ * Revert an action, which is either one delta or a whole sequence.
+ * Return the next undo entry.
  */
 static Undo *
 revert_action (Undo * up)
 {
-  if (up->type == UNDO_END_SEQUENCE)
+  Undo_run run = {.text = {.as = NULL}};
+  int depth = 0;
+  do
     {
-      undo_start_sequence ();
+      if (up->type == UNDO_REPLACE_BLOCK)
+        {
+          estr old = undo_text (up);
+          if (old.as == NULL)
+            {
+              minibuf_error ("Error reading undo information");
+              break;
+            }
+          if (!run_add (&run, up, old))
+            {
+              run_flush (&run);
+              run_add (&run, up, old);
+            }
+        }
+      else
+        {
+          run_flush (&run);
+          if (up->type == UNDO_END_SEQUENCE)
+            {
+              undo_start_sequence ();
+              depth++;
+            }
+          else
+            {
+              if (depth > 0)
+                {
+                  undo_end_sequence ();
+                  depth--;
+                }
+              goto_offset (up->o);
+              if (up->unchanged)
+                set_buffer_modified (cur_bp, false);
+            }
+        }
       up = up->next;
-      while (up->type != UNDO_START_SEQUENCE)
-        up = revert_action (up);
-      undo_end_sequence ();
     }
+  while (depth > 0 && up != NULL);
+  run_flush (&run);
 
-  if (up->type != UNDO_END_SEQUENCE)
-    goto_offset (up->o);
-  if (up->type == UNDO_REPLACE_BLOCK)
-    replace_estr (up->size, up->text);
-  if (up->unchanged)
-    set_buffer_modified (cur_bp, false);
+  /* Close any sequence whose start has been trimmed. */
+  for (; depth > 0; depth--)
+    undo_end_sequence ();
 
-  return up->next;
+  return up;
 }
 
 SCM_DEFINE (G_undo, "undo", 0, 0, 0, (void), "\
@@ -139,11 +599,24 @@ Repeat this command to undo more changes.")
       return SCM_BOOL_F;
     }
 
+  undo_close_coalesce ();
+  reverting = true;
   set_buffer_next_undop (cur_bp, revert_action (get_buffer_next_undop (cur_bp)));
+  reverting = false;
+  undo_close_coalesce ();
   minibuf_write ("Undo!");
   return SCM_BOOL_T;
 }
 
+SCM_DEFINE (G_buffer_undo_size, "buffer-undo-size", 0, 0, 0, (void), "\
+Return the number of bytes used by the current buffer's undo information.")
+{
+  size_t n = get_buffer_undo_size (cur_bp);
+  if (interactive)
+    minibuf_write ("%zu bytes", n);
+  return scm_from_size_t (n);
+}
+
 /*
  * Set unchanged flags to false.
  */
@@ -159,5 +632,6 @@ init_guile_undo_procedures (void)
 {
 #include "undo.x"
   scm_c_export ("undo",
+		"buffer-undo-size",
 		NULL);
 }
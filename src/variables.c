@@ -45,6 +45,14 @@ SCM_GLOBAL_VARIABLE_INIT (Gvar_fill_column, "fill-column",
 			  scm_from_long (70));
 SCM_GLOBAL_VARIABLE_INIT (Gvar_auto_fill_mode, "%auto-fill-mode",
 			  SCM_BOOL_F);
+SCM_GLOBAL_VARIABLE_INIT (Gvar_piece_table_mode, "%piece-table-mode",
+			  SCM_BOOL_F);
+SCM_GLOBAL_VARIABLE_INIT (Gvar_undo_limit, "undo-limit",
+			  scm_from_long (160000));
+SCM_GLOBAL_VARIABLE_INIT (Gvar_undo_strong_limit, "undo-strong-limit",
+			  scm_from_long (240000));
+SCM_GLOBAL_VARIABLE_INIT (Gvar_undo_spill_threshold, "undo-spill-threshold",
+			  scm_from_long (1048576));
 SCM_GLOBAL_VARIABLE_INIT (Gvar_kill_whole_line, "kill-whole-line",
 			  SCM_BOOL_F);
 SCM_GLOBAL_VARIABLE_INIT (Gvar_case_fold_search, "case-fold-search",
@@ -0,0 +1,13 @@
+(forward-line)
+(forward-line)
+(forward-line)
+(forward-word)
+(set-mark (point))
+(beginning-of-buffer)
+(insert "One. ")
+(forward-line)
+(kill-line)
+(exchange-point-and-mark)
+(insert "[mark]")
+(save-buffer)
+(save-buffers-kill-emacs)
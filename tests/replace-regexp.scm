@@ -0,0 +1,3 @@
+(replace-regexp "l[ei]" "x")
+(save-buffer)
+(save-buffers-kill-emacs)
@@ -0,0 +1,3 @@
+(replace-string "s" "ss")
+(save-buffer)
+(save-buffers-kill-emacs)
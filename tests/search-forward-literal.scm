@@ -0,0 +1,4 @@
+(search-forward "e.")
+(insert "a")
+(save-buffer)
+(save-buffers-kill-emacs)
@@ -0,0 +1,6 @@
+(setq markers (buffer-marker-count))
+(forward-line)
+(kill-line)
+(insert (if (= (buffer-marker-count) markers) "No markers left over." "Markers left over!"))
+(save-buffer)
+(save-buffers-kill-emacs)
@@ -0,0 +1,12 @@
+; multi-occur lists the matching lines of every buffer.  The big
+; buffer is searched in several parts, whose line counts are added up.
+(switch-to-buffer "big")
+(insert (string-concatenate (make-list 100000 "filler line\n")))
+(insert "a needle after the first megabyte\n")
+(switch-to-buffer "multi-occur.input")
+(end-of-buffer)
+(insert "Another needle.\n")
+(multi-occur "needle")
+(insert-buffer "*Occur*")
+(save-buffer)
+(save-buffers-kill-emacs)
@@ -0,0 +1,6 @@
+; occur lists the lines that contain a literal string.
+(occur "e")
+(end-of-buffer)
+(insert-buffer "*Occur*")
+(save-buffer)
+(save-buffers-kill-emacs)
@@ -0,0 +1,12 @@
+; occur counts the lines of a file with DOS line endings.
+(let ((coding-system-for-write (quote dos)))
+  (with-temp-file "occur_crlf.tmp"
+    (insert "one\ntwo needle\nthree\nfour needle\n")))
+(find-file "occur_crlf.tmp")
+(delete-file "occur_crlf.tmp")
+(occur "needle")
+(switch-to-buffer "occur_crlf.input")
+(end-of-buffer)
+(insert-buffer "*Occur*")
+(save-buffer)
+(save-buffers-kill-emacs)
@@ -0,0 +1,12 @@
+; occur counts the lines of a file with DOS line endings.
+(call-with-output-file "occur_crlf.tmp"
+  (lambda (port)
+    (display "one\r\ntwo needle\r\nthree\r\nfour needle\r\n" port)))
+(find-file "occur_crlf.tmp")
+(delete-file "occur_crlf.tmp")
+(occur "needle")
+(switch-to-buffer "occur_crlf.input")
+(end-of-buffer)
+(insert-buffer "*Occur*")
+(save-buffer)
+(save-buffers-kill-emacs)
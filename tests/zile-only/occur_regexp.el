@@ -0,0 +1,6 @@
+; occur lists the lines that match a regexp.
+(occur "^It\\|graph\\.$")
+(end-of-buffer)
+(insert-buffer "*Occur*")
+(save-buffer)
+(save-buffers-kill-emacs)
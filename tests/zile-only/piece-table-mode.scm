@@ -0,0 +1,17 @@
+; Edits in Piece Table mode are undone back to the original text.
+; The first undo after a script's edits only reports that there is
+; no further undo information; the next ones undo the edits.
+(piece-table-mode)
+(end-of-line)
+(delete-char 3)
+(backward-delete-char 2)
+(forward-line)
+(insert "new ")
+(undo)
+(undo)
+(undo)
+(undo)
+(beginning-of-buffer)
+(insert "All undone. ")
+(save-buffer)
+(save-buffers-kill-emacs)
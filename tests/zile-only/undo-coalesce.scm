@@ -0,0 +1,10 @@
+; The first undo after a script's edits only reports that there is
+; no further undo information; the next ones undo the edits.
+(end-of-line)
+(delete-char 3)
+(backward-delete-char 2)
+(undo)
+(undo)
+(undo)
+(save-buffer)
+(save-buffers-kill-emacs)
@@ -0,0 +1,9 @@
+; Past undo-strong-limit, only the most recent change is kept.
+(insert "one ")
+(define one (buffer-undo-size))
+(set-variable 'undo-limit one)
+(set-variable 'undo-strong-limit (+ one one -1))
+(insert "two ")
+(insert (if (= (buffer-undo-size) one) "Kept one change. " "Kept too much! "))
+(save-buffer)
+(save-buffers-kill-emacs)